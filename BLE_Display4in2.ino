@@ -14,20 +14,24 @@
 #include <sys/time.h>
 #include <soc/rtc.h>
 #include <esp_deep_sleep.h>
+#include <esp_pm.h>
 #include <Fsm.h>
 #include "btcom.h"
 #include "configuration.h"
+#include "display.h"
 #include "hmi.h"
 #include "touch.h"
 #include "main.h"
+#include "power.h"
+#include "telemetry.h"
+#include "rtcstate.h"
+#include "timesync.h"
+#include "wakestub.h"
 
-#define uS_TO_S_FACTOR 1000000    
-RTC_DATA_ATTR int bootCount = 0;
+enum class Wakeup {COLD_BOOT, MINUTE_TICK, SYNC_TICK, TOUCH};
 
 uint32_t startTime;
-uint32_t lastInteractionTime;
 esp_sleep_wakeup_cause_t wakeupReason;
-uint16_t sleepTimeout = 13000;
 
 CTouch touchL(T6, BUTTON_L_TH, &handleTouch);
 CTouch touchLM(T7, BUTTON_LM_TH, &handleTouch);
@@ -35,57 +39,117 @@ CTouch touchRM(T9, BUTTON_RM_TH, &handleTouch);
 CTouch touchR(T8, BUTTON_R_TH, &handleTouch);
 
 
+/*! \fn Wakeup getWakeup(bool firstBoot)
+ *  \brief classify the reason of the current boot to initialize only the required subsystems
+ */
+Wakeup getWakeup(bool firstBoot){
+  if (firstBoot || wakeupReason == ESP_SLEEP_WAKEUP_UNDEFINED){
+    return Wakeup::COLD_BOOT;
+  }
+  if (wakeupReason == ESP_DEEP_SLEEP_WAKEUP_TOUCHPAD){
+    return Wakeup::TOUCH;
+  }
+  if (((rtcState.bootCount % commIntervalls[hour()]) == 0) || (year() < 2016)){
+    return Wakeup::SYNC_TICK;
+  }
+  return Wakeup::MINUTE_TICK;
+}
+
+/*! \fn void touchInit()
+ *  \brief init touch interrupt and calibrate the touch thresholds, which are used for wakeup as well. 
+ *  The touch configuration is part of the RTC domain and survives deep sleep, but it is reset by the driver init, 
+ *  so it has to be set on every boot which uses the touch inputs.
+ */
+void touchInit(){
+  touchBegin();
+  touchL.begin();
+  touchLM.begin();
+  touchRM.begin();
+  touchR.begin();
+}
+
+/*! \fn void lightSleepInit()
+ *  \brief enable automatic light sleep while all tasks are blocked during interactive sessions. Touch and FreeRTOS timeouts
+ *  wake up the CPU, display refresh and BLE hold power management locks while active.
+ *  Requires power management and tickless idle in the SDK configuration, otherwise the CPU idles without light sleep
+ */
+void lightSleepInit(){
+  esp_sleep_enable_touchpad_wakeup();
+#if CONFIG_PM_ENABLE && CONFIG_FREERTOS_USE_TICKLESS_IDLE
+  esp_pm_config_esp32_t pmConfig;
+  pmConfig.max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+  pmConfig.min_freq_mhz = CONFIG_ESP32_XTAL_FREQ > 0 ? CONFIG_ESP32_XTAL_FREQ : 40;
+  pmConfig.light_sleep_enable = true;
+  if (esp_pm_configure(&pmConfig) != ESP_OK){
+    Serial.println("Light sleep not available");
+  }
+#endif
+}
+
 void setup(){
   startTime = millis();
-  lastInteractionTime = startTime;
-  Serial.begin(115200);
 
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
-  setTime(tv.tv_sec);
-
-  // Prepare touch inputs for wakeup
-  touch_pad_t touchPin = esp_sleep_get_touchpad_wakeup_status();
-  touchAttachInterrupt(T6, nullptr, BUTTON_L_TH);
-  touchAttachInterrupt(T7, nullptr, BUTTON_LM_TH);
-  touchAttachInterrupt(T9, nullptr, BUTTON_RM_TH);
-  touchAttachInterrupt(T8, nullptr, BUTTON_R_TH);
-    
-  displayInit (bootCount == 0);
+  rtcStateValidate();   // cold boot state if invalid
+  timeInit();
+
   wakeupReason = esp_sleep_get_wakeup_cause();
-  ++bootCount;
-  screenManager.triggerEvent(Event::SCREEN_ENTRY); // Event handler after wakeup, this screen is invisble
-  
-  if (((bootCount % commIntervalls[hour()]) == 0) || (year() < 2016) || wakeupReason == ESP_DEEP_SLEEP_WAKEUP_TOUCHPAD){ 
-    if(wakeupReason == ESP_DEEP_SLEEP_WAKEUP_TOUCHPAD){
-      sleepTimeout = 2*60*1000;
-      // get GPOI which caused wakeup and stimulate event loop
-      switch(touchPin)
-      {
-        case 6: touchL.inject(); break;
-        case 7: touchLM.inject(); break;
-        case 8: touchR.inject(); break;
-        case 9: touchRM.inject(); break;
-      }
-    } else{
-      screenManager.triggerEvent(Event::SCREEN_MAIN);
+  bool firstBoot = (rtcState.bootCount == 0);
+  rtcState.bootCount += wakeStubTakeSkipped() + 1;
+  Wakeup wakeup = getWakeup(firstBoot);
+
+  // Minute tick: only the clock has to be updated, no serial, touch, event loop, timers or BLE
+  if (wakeup == Wakeup::MINUTE_TICK){
+    if (!screenManager.showPrerendered()){
+      displayInit(false);
+      screenManager.show(Event::SCREEN_MAIN);
     }
-    BLEscan();
-  } else {
-    screenManager.triggerEvent(Event::SCREEN_MAIN);  
     sleep();
-  }   
+  }
+
+  Serial.begin(115200);
+  powerBegin();
+  touchInit();
+  // Touch: confirm the wakeup before display and BLE are powered
+  CTouch* wakeTouch = nullptr;
+  if (wakeup == Wakeup::TOUCH){
+    switch(esp_sleep_get_touchpad_wakeup_status())
+    {
+      case 6: wakeTouch = &touchL; break;
+      case 7: wakeTouch = &touchLM; break;
+      case 8: wakeTouch = &touchR; break;
+      case 9: wakeTouch = &touchRM; break;
+    }
+    if (wakeTouch == nullptr || !wakeTouch->confirmWake()){
+      deepSleep(getSkippableWakes());
+    }
+  }
+  lightSleepInit();
+  displayInit (firstBoot);
+  screenManager.begin();
+  screenManager.triggerEvent(Event::SCREEN_ENTRY); // Event handler after wakeup, this screen is invisble
+  
+  if(wakeup == Wakeup::TOUCH){
+    // stimulate event loop with the touch input which caused wakeup
+    wakeTouch->inject();
+  } else{
+    screenManager.triggerEvent(Event::SCREEN_MAIN);
+  }
+  BLEscan();
 }
 
 void loop() {
-  vTaskDelay(50);
-  if ((millis()-lastInteractionTime) > sleepTimeout){
-    sleep(); // just to make shure to sleep if something wents wrong
-  }
+  // wait for touch interrupt or power state change, poll only while a button is pressed to recognize the release. 
+  // The CPU enters light sleep while waiting
+  bool pressed = touchL.pressed() || touchLM.pressed() || touchRM.pressed() || touchR.pressed();
+  touchWait(pressed ? pdMS_TO_TICKS(20) : powerTimeout());
   touchL.debounce();
   touchLM.debounce();
   touchRM.debounce();
   touchR.debounce();    
+  if (powerUpdate(screenManager.idle()) == PowerState::SLEEP){
+    telemetryReport();
+    sleep();
+  }
 }
 
 void handleTouch (uint8_t touch, boolean state) {
@@ -103,20 +167,40 @@ void handleTouch (uint8_t touch, boolean state) {
   }
 }
 
+/*! \fn uint8_t getSkippableWakes()
+ *  \brief number of following minute wakeups which neither need a clock update nor a BLE synchronization
+ */
+uint8_t getSkippableWakes(){
+  uint8_t toClockUpdate = clockIntervalls[hour()] - minute() % clockIntervalls[hour()];
+  uint8_t toSync = commIntervalls[hour()] - rtcState.bootCount % commIntervalls[hour()];
+  return min(toClockUpdate, toSync) - 1;
+}
+
 /*! \fn void sleep()
  *  \brief enter deep sleep until new minute starts or button pressed
  */
 void sleep(){
     Serial.print("Going to sleep after ");
     Serial.println((uint32_t)(millis()-startTime));
+    uint8_t skipWakes = getSkippableWakes();
+    // render clock of next wakeup while display is refreshing
+    screenManager.prerender(now() - now()%60 + (skipWakes+1)*60);
     displayOff();
+    deepSleep(skipWakes);
+}
+
+/*! \fn void deepSleep(uint8_t skipWakes)
+ *  \brief enter deep sleep without display handling, e.g. after a rejected touch wakeup. The prerendered clock stays valid
+ */
+void deepSleep(uint8_t skipWakes){
     esp_deep_sleep_enable_touchpad_wakeup();
-    uint8_t sleepTime = 60-second();
-    esp_sleep_enable_timer_wakeup(sleepTime * uS_TO_S_FACTOR);
+    esp_sleep_enable_timer_wakeup(timeToNextMinute());
+    wakeStubPlan(skipWakes);
+    rtcStateSeal();
     esp_deep_sleep_start();  
 }
 
 
 
 
-
+
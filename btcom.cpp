@@ -20,8 +20,17 @@
 #include <sys/time.h>
 #include <Fsm.h>
 #include <FreeRTOS.h>
+#include <freertos/semphr.h>
 #include "btcom.h"
 #include "hmi.h"
+#include "timesync.h"
+#include "power.h"
+#include "telemetry.h"
+#include "rtcstate.h"
+#include "timetable.h"
+#include "garbage.h"
+#include "history.h"
+#include "rooms.h"
 
 #define BASE_UUID "-0000-1000-8000-00805f9b34fb"
 
@@ -35,12 +44,16 @@ static BLEUUID outdoorTemperatureUUID("00003a1f" BASE_UUID);   // Outdoor Temper
 static BLEUUID outdoorHumidityUUID("00003a6f" BASE_UUID);      // Humidity
 static BLEUUID partyModeUUID("0000d379" BASE_UUID);     // Party mode prolongs heating
 static BLEUUID presenceUUID("0000d380" BASE_UUID);      // Home presence
-static BLEUUID windowUUID("0000d390" BASE_UUID);        // Window state
+static BLEUUID windowUUID("0000d390" BASE_UUID);        // Window state, one byte per room
+static BLEUUID windowStateUUID("0000d394" BASE_UUID);   // Window state, 2 bits per room
+static BLEUUID roomsUUID("0000d391" BASE_UUID);         // Room names and floors
 static BLEUUID audioUUID("0000d3A0" BASE_UUID);         // Audio on//off
 static BLEUUID busUUID("0000d3B0" BASE_UUID);           // Bus timetable
+static BLEUUID busDayUUID("0000d3B1" BASE_UUID);        // Timetable of the day of all routes, delta encoded
 static BLEUUID garbageUUID("0000d392" BASE_UUID);       // Next garbage collection
+static BLEUUID garbageCalendarUUID("0000d393" BASE_UUID); // Garbage collection dates of next months
 
-static BLEAddress *pServerAddress;
+static esp_bd_addr_t serverAddress;
 static BLERemoteService* pRemoteService;
 static BLERemoteCharacteristic* pDateTimeCharacteristic;
 static BLERemoteCharacteristic* pPartyModeCharacteristic;
@@ -50,31 +63,39 @@ static BLERemoteCharacteristic* pHumidityCharacteristic;
 static BLERemoteCharacteristic* pOutdoorTemperatureCharacteristic;
 static BLERemoteCharacteristic* pOutdoorHumidityCharacteristic;
 static BLERemoteCharacteristic* pWindowCharacteristic;
+static BLERemoteCharacteristic* pWindowStateCharacteristic;
+static BLERemoteCharacteristic* pRoomsCharacteristic;
 static BLERemoteCharacteristic* pAudioCharacteristic;
 static BLERemoteCharacteristic* pBusCharacteristic;
+static BLERemoteCharacteristic* pBusDayCharacteristic;
 static BLERemoteCharacteristic* pGarbageCharacteristic;
+static BLERemoteCharacteristic* pGarbageCalendarCharacteristic;
 static BLEAdvertisedDevice bleDevice;
 static uint16_t scanStartTime;
+static bool deviceFound = false;
 
-// Party mode characteristic
-#define PM_INVALID 99
-RTC_DATA_ATTR uint8_t pmHour = PM_INVALID;
-RTC_DATA_ATTR uint8_t pmMinute = 0;
-RTC_DATA_ATTR float temperature;
-RTC_DATA_ATTR uint8_t humidity;
-RTC_DATA_ATTR float outdoorTemperature;
-RTC_DATA_ATTR uint8_t outdoorHumidity;
-RTC_DATA_ATTR uint8_t windows[(int)Room::LAST];
-RTC_DATA_ATTR struct Schedule busTimeTable[3];
-RTC_DATA_ATTR struct Garbage nextGarbageCollection = {GarbageType::UNDEFINED, 255};
+// scan, connection and data transfer run in one statically allocated task, the only user of the BLE client
+#define SYNC_STACK_SIZE 4096
+static StackType_t syncStack[SYNC_STACK_SIZE];
+static StaticTask_t syncTaskBuffer;
+
+// commands of other tasks are kept pending and executed by the sync task while connected
+static SemaphoreHandle_t commandSemaphore = nullptr;
+static StaticSemaphore_t commandSemaphoreBuffer;
+portMUX_TYPE commandMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Status is received into the staging copy and published to the RTC state at the end of the connection.
+// Bulk data is written to the RTC state under the same lock.
+static struct Status staging;
+portMUX_TYPE statusMux = portMUX_INITIALIZER_UNLOCKED;
 
 /**
- * @brief get charcteristic with given UUID
+ * @brief get charcteristic with given UUID. Must only be called by the sync task.
  * 
  * @param uuid 
  * @return BLERemoteCharacteristic* 
  */
-BLERemoteCharacteristic*  getCharacteristic(BLEUUID uuid){
+static BLERemoteCharacteristic* getCharacteristic(BLEUUID uuid){
   BLERemoteCharacteristic* pCharacteristic = pRemoteService->getCharacteristic(uuid);
   if (pCharacteristic == nullptr) {
     Serial.print("Failed to find characteristic UUID: ");
@@ -84,98 +105,75 @@ BLERemoteCharacteristic*  getCharacteristic(BLEUUID uuid){
 }
 
 // Presence characteristic
-boolean homeModeSent = true;
-boolean atHome = false;
+static boolean homeModeSent = true;
+static boolean atHome = false;
 
 // Audio characteristic
-boolean audioModeSent = true;
-boolean audioOn = false;
-
-/**
- * @brief Get next garbage collection
- * 
- * @return struct Garbage 
- */
-struct Garbage getNextGarbageCollection(){
-  return nextGarbageCollection;
-}
+static boolean audioModeSent = true;
+static boolean audioOn = false;
 
 /**
- * @brief Get temperature
+ * @brief Get a consistent copy of the last published status.
  * 
- * @return float 
+ * @return struct Status 
  */
-float getTemperature(){
-  return temperature;
+struct Status getStatus(){
+  portENTER_CRITICAL(&statusMux);
+  struct Status copy = rtcState.status;
+  portEXIT_CRITICAL(&statusMux);
+  return copy;
 }
 
 /**
- * @brief Get humidity
+ * @brief Get a consistent copy of all received data.
  * 
- * @return uint8_t 
+ * @param snapshot 
  */
-uint8_t getHumidity(){
-  return humidity;
+void getSnapshot(struct Snapshot* snapshot){
+  portENTER_CRITICAL(&statusMux);
+  snapshot->status = rtcState.status;
+  snapshot->timetable = rtcState.timetable;
+  snapshot->garbage = rtcState.garbage;
+  snapshot->history = rtcState.history;
+  snapshot->rooms = rtcState.rooms;
+  portEXIT_CRITICAL(&statusMux);
 }
 
 /**
- * @brief Get outdor temperature
+ * @brief Publish the staging copy as new status.
  * 
- * @return float 
  */
-float getOutdoorTemperature(){
-  return outdoorTemperature;
+static void publishStatus(){
+  portENTER_CRITICAL(&statusMux);
+  staging.version = rtcState.status.version + 1;
+  rtcState.status = staging;
+  portEXIT_CRITICAL(&statusMux);
+  historyAdd(now(), &staging);
 }
 
 /**
- * @brief Get outdoor humidity
+ * @brief Wake the sync task to execute pending commands.
  * 
- * @return uint8_t 
  */
-uint8_t getOutdoorHumidity(){
-  return outdoorHumidity;
-}
-
-/**
- * @brief Get array with window status
- * 
- * @return uint8_t* 
- */
-uint8_t* getWindows(){
-  return windows;
-}
-
-/**
- * @brief Get array with timetable of next busses
- * 
- * @return uint16_t* 
- */
-struct Schedule* getBusTimeTable(){
-  return busTimeTable;
+static void sendCommand(){
+  if (commandSemaphore != nullptr){
+    xSemaphoreGive(commandSemaphore);
+  }
 }
 
-
 /**
- * @brief Write the new time to end the party mode as BLE value
+ * @brief Write the new time to end the party mode as BLE value. The value is written by the sync task 
+ *  while connected, with the next connection otherwise.
  * 
  * @param hour Hour when party mode should be ended
  * @param minute Minute when party mode should be ended
  */
 void writePartyMode(uint8_t hour, uint8_t minute){
-  if (pRemoteService != nullptr){
-    pPartyModeCharacteristic = getCharacteristic(partyModeUUID);
-    if (pPartyModeCharacteristic != nullptr){
-      char buffer[6];
-      snprintf(buffer, 6, "%02d:%02d", hour, minute);
-      pPartyModeCharacteristic->writeValue(buffer, true);
-      pmHour = PM_INVALID;
-      Serial.println ("PM-Value written");
-      screenManager.triggerEvent(Event::DATA_SENT);
-    }
-  } else {
-    pmHour = hour;
-    pmMinute = minute;
-  }
+  portENTER_CRITICAL(&commandMux);
+  rtcState.pmHour = hour;
+  rtcState.pmMinute = minute;
+  portEXIT_CRITICAL(&commandMux);
+  sendCommand();
 }
 
 
@@ -186,28 +184,21 @@ void writePartyMode(uint8_t hour, uint8_t minute){
  * @return false Party mode end time not written
  */
 bool partyModeWritten(){
-  return pmHour == PM_INVALID;
+  return rtcState.pmHour == PM_INVALID;
 }
 
 
 /**
- * @brief Set home mode as home or absent as BLE value 
+ * @brief Set home mode as home or absent as BLE value. The value is written by the sync task.
  * 
  * @param home True if at home
  */
 void writeHomeMode(boolean home){
-  if (pRemoteService != nullptr){
-    pPresenceCharacteristic = getCharacteristic(presenceUUID);
-    if (pPresenceCharacteristic != nullptr){
-      pPresenceCharacteristic->writeValue(home?"home":"absent", true);
-      Serial.println ("Presence-Value written");
-      homeModeSent = true; 
-      screenManager.triggerEvent(Event::DATA_SENT);
-    }
-  } else {
-    atHome = home;
-    homeModeSent = false; 
-  }
+  portENTER_CRITICAL(&commandMux);
+  atHome = home;
+  homeModeSent = false; 
+  portEXIT_CRITICAL(&commandMux);
+  sendCommand();
 }
 
 
@@ -223,23 +214,16 @@ bool homeModeWritten(){
 
 
 /**
- * @brief Set amplifier on or off as BLE value 
+ * @brief Set amplifier on or off as BLE value. The value is written by the sync task.
  * 
  * @param on 
  */
 void writeAudioMode(boolean on){
-  if (pRemoteService != nullptr){
-    pAudioCharacteristic = getCharacteristic(audioUUID);
-    if (pAudioCharacteristic != nullptr){
-      pAudioCharacteristic->writeValue(on?"on":"off", true);
-      Serial.println ("Audio-Value written");
-      audioModeSent = true; 
-      screenManager.triggerEvent(Event::DATA_SENT);
-    }
-  } else {
-    audioOn = on;
-    audioModeSent = false; 
-  }
+  portENTER_CRITICAL(&commandMux);
+  audioOn = on;
+  audioModeSent = false; 
+  portEXIT_CRITICAL(&commandMux);
+  sendCommand();
 }
 
 /**
@@ -252,6 +236,62 @@ bool audioModeWritten(){
   return audioModeSent;
 }
 
+/**
+ * @brief Write pending commands to the BLE server. Called by the sync task while connected.
+ *  A command is only marked as sent if its value was not changed meanwhile.
+ * 
+ */
+static void writePending(){
+  portENTER_CRITICAL(&commandMux);
+  uint8_t hour = rtcState.pmHour;
+  uint8_t minute = rtcState.pmMinute;
+  boolean home = atHome;
+  boolean homePending = !homeModeSent;
+  boolean audio = audioOn;
+  boolean audioPending = !audioModeSent;
+  portEXIT_CRITICAL(&commandMux);
+
+  if (hour <= 24){ // value was set
+    pPartyModeCharacteristic = getCharacteristic(partyModeUUID);
+    if (pPartyModeCharacteristic != nullptr){
+      char buffer[6];
+      snprintf(buffer, 6, "%02d:%02d", hour, minute);
+      pPartyModeCharacteristic->writeValue(buffer, true);
+      portENTER_CRITICAL(&commandMux);
+      if (rtcState.pmHour == hour && rtcState.pmMinute == minute){
+        rtcState.pmHour = PM_INVALID;
+      }
+      portEXIT_CRITICAL(&commandMux);
+      Serial.println ("PM-Value written");
+      screenManager.triggerEvent(Event::DATA_SENT);
+    }
+  }
+
+  if (homePending){
+    pPresenceCharacteristic = getCharacteristic(presenceUUID);
+    if (pPresenceCharacteristic != nullptr){
+      pPresenceCharacteristic->writeValue(home?"home":"absent", true);
+      portENTER_CRITICAL(&commandMux);
+      homeModeSent = atHome == home;
+      portEXIT_CRITICAL(&commandMux);
+      Serial.println ("Presence-Value written");
+      screenManager.triggerEvent(Event::DATA_SENT);
+    }
+  }
+
+  if (audioPending){
+    pAudioCharacteristic = getCharacteristic(audioUUID);
+    if (pAudioCharacteristic != nullptr){
+      pAudioCharacteristic->writeValue(audio?"on":"off", true);
+      portENTER_CRITICAL(&commandMux);
+      audioModeSent = audioOn == audio;
+      portEXIT_CRITICAL(&commandMux);
+      Serial.println ("Audio-Value written");
+      screenManager.triggerEvent(Event::DATA_SENT);
+    }
+  }
+}
+
 /**
  * @brief Build a connection to the BLE server
  * 
@@ -283,87 +323,120 @@ bool connectToServer(BLEAddress pAddress) {
   }
   Serial.print(" - Found service ");
   Serial.println(millis() - scanStartTime);
-
-  pDateTimeCharacteristic = getCharacteristic(curTimeUUID);
-  if (pDateTimeCharacteristic != nullptr){
-    std::string value = pDateTimeCharacteristic->readValue();
-    uint16_t yr = (uint8_t)value[0] + 256*(uint8_t)value[1];
-    uint8_t mth = (uint8_t)value[2];
-    uint8_t d = (uint8_t)value[3];
-    uint8_t h = (uint8_t)value[4];
-    uint8_t m = (uint8_t)value[5];
-    uint8_t s = (uint8_t)value[6];
-    setTime(h, m, s, d, mth, yr);
-    // use ESP 32 RTC which continues during deep sleep
-    struct timeval tv; 
-    tv.tv_sec = now();
-    tv.tv_usec = 0;
-    settimeofday(&tv, nullptr);
-    screenManager.triggerEvent(Event::TIME_UPDATE);
-  }
-
-  if (pmHour <= 24){ // value was set
-    writePartyMode(pmHour, pmMinute);
-  }
-
-  if(!homeModeSent){
-    writeHomeMode(atHome);
+  staging = getStatus();
+
+  if (timeSyncDue()){
+    pDateTimeCharacteristic = getCharacteristic(curTimeUUID);
+    if (pDateTimeCharacteristic != nullptr){
+      std::string value = pDateTimeCharacteristic->readValue();
+      uint16_t yr = (uint8_t)value[0] + 256*(uint8_t)value[1];
+      uint8_t mth = (uint8_t)value[2];
+      uint8_t d = (uint8_t)value[3];
+      uint8_t h = (uint8_t)value[4];
+      uint8_t m = (uint8_t)value[5];
+      uint8_t s = (uint8_t)value[6];
+      // fractions of second in 1/256 s according GATT current time, if provided
+      uint32_t usec = value.length() > 8 ? (uint8_t)value[8]*1000000/256 : 0;
+      setTime(h, m, s, d, mth, yr);
+      // use ESP 32 RTC which continues during deep sleep
+      timeSync(now(), usec);
+    }
   }
 
-  if(!audioModeSent){
-    writeAudioMode(audioOn);
-  }
+  writePending();
   
   pTemperatureCharacteristic = getCharacteristic(temperatureUUID);
   if (pTemperatureCharacteristic != nullptr){
     std::string value = pTemperatureCharacteristic->readValue();
     int16_t temp = value[0] | value[1]<<8;
-    temperature = (float)temp/10;
-    screenManager.triggerEvent(Event::TEMPERATURE);
+    staging.temperature = (float)temp/10;
+    staging.received[FIELD_TEMPERATURE] = now();
   }
   
   pHumidityCharacteristic = getCharacteristic(humidityUUID);
   if (pHumidityCharacteristic != nullptr){
     std::string value = pHumidityCharacteristic->readValue();
-    humidity = (value[0] + (value[1]<<8))/100;
-    screenManager.triggerEvent(Event::HUMIDITY);
+    staging.humidity = (value[0] + (value[1]<<8))/100;
+    staging.received[FIELD_HUMIDITY] = now();
   }
 
   pOutdoorTemperatureCharacteristic = getCharacteristic(outdoorTemperatureUUID);
   if (pOutdoorTemperatureCharacteristic != nullptr){
     std::string value = pOutdoorTemperatureCharacteristic->readValue();
     int16_t temp = value[0] | value[1]<<8;
-    outdoorTemperature = (float)temp/10;
+    staging.outdoorTemperature = (float)temp/10;
+    staging.received[FIELD_OUTDOOR_TEMPERATURE] = now();
   }
 
   pOutdoorHumidityCharacteristic = getCharacteristic(outdoorHumidityUUID);
   if (pOutdoorHumidityCharacteristic != nullptr){
     std::string value = pOutdoorHumidityCharacteristic->readValue();
-    outdoorHumidity = (value[0] + (value[1]<<8))/100;
+    staging.outdoorHumidity = (value[0] + (value[1]<<8))/100;
+    staging.received[FIELD_OUTDOOR_HUMIDITY] = now();
   }  
   
-  pWindowCharacteristic = getCharacteristic(windowUUID);
-  if (pWindowCharacteristic != nullptr){
-    std::string value = pWindowCharacteristic->readValue();
-    memcpy (windows, value.c_str(), (int)Room::LAST);
-    screenManager.triggerEvent(Event::WINDOW);
+  // packed window state, room names are read only if the registry of the server changed
+  pWindowStateCharacteristic = getCharacteristic(windowStateUUID);
+  if (pWindowStateCharacteristic != nullptr){
+    std::string value = pWindowStateCharacteristic->readValue();
+    windowsStore(&staging, (const uint8_t*)value.c_str(), value.length());
+    staging.received[FIELD_WINDOWS] = now();
+    if (value.length() > 0 && !roomsValid(value[0])){
+      pRoomsCharacteristic = getCharacteristic(roomsUUID);
+      if (pRoomsCharacteristic != nullptr){
+        std::string rooms = pRoomsCharacteristic->readValue();
+        roomsStore((const uint8_t*)rooms.c_str(), rooms.length());
+      }
+    }
+  } else {
+    // server without room registry
+    pWindowCharacteristic = getCharacteristic(windowUUID);
+    if (pWindowCharacteristic != nullptr){
+      std::string value = pWindowCharacteristic->readValue();
+      windowsStoreLegacy(&staging, (const uint8_t*)value.c_str(), value.length());
+      staging.received[FIELD_WINDOWS] = now();
+    }
+  }
+
+  // calendar of collections is refreshed rarely, the days until collection are calculated locally
+  if (garbageRefreshDue(now()) && year() >= 2016){
+    pGarbageCalendarCharacteristic = getCharacteristic(garbageCalendarUUID);
+    if (pGarbageCalendarCharacteristic != nullptr){
+      std::string value = pGarbageCalendarCharacteristic->readValue();
+      garbageStore((const uint8_t*)value.c_str(), value.length());
+    }
   }
 
-  if (hour() == 0 || nextGarbageCollection.type == GarbageType::UNDEFINED){        // sync @ midnight or if not synced before
+  // next collection from server, if there is no calendar
+  if (garbageRefreshDue(now()) && (hour() == 0 || staging.nextGarbageCollection.type == GarbageType::UNDEFINED)){        // sync @ midnight or if not synced before
     pGarbageCharacteristic = getCharacteristic(garbageUUID);
     if (pGarbageCharacteristic != nullptr){
       std::string value = pGarbageCharacteristic->readValue();
       uint8_t *buffer = (uint8_t*)value.c_str();
-      nextGarbageCollection.type = (enum GarbageType)buffer[0];
-      nextGarbageCollection.days = buffer[1];
+      staging.nextGarbageCollection.type = (enum GarbageType)buffer[0];
+      staging.nextGarbageCollection.days = buffer[1];
+      staging.received[FIELD_GARBAGE] = now();
+    }
+  }
+
+  // timetable of the day once a day, the next departures are derived locally
+  if (!timetableValid(&rtcState.timetable, now()) && year() >= 2016){
+    pBusDayCharacteristic = getCharacteristic(busDayUUID);
+    if (pBusDayCharacteristic != nullptr){
+      std::string value = pBusDayCharacteristic->readValue();
+      timetableStore((const uint8_t*)value.c_str(), value.length(), now());
     }
   }
 
-  pBusCharacteristic = getCharacteristic(busUUID);
+  // next departures from server, if there is no timetable of the day
+  pBusCharacteristic = timetableValid(&rtcState.timetable, now()) ? nullptr : getCharacteristic(busUUID);
   if (pBusCharacteristic != nullptr){
     std::string value = pBusCharacteristic->readValue();
-    memcpy(busTimeTable, value.c_str(), 3*sizeof(struct Schedule));
+    staging.busCount = min(value.length()/sizeof(struct Schedule), (size_t)TIMETABLE_NEXT);
+    memcpy(staging.busTimeTable, value.c_str(), staging.busCount*sizeof(struct Schedule));
+    staging.received[FIELD_BUS] = now();
   }  
+  publishStatus();
 
   Serial.print(" - Data received ");
   Serial.println(millis() - scanStartTime);  
@@ -371,23 +444,6 @@ bool connectToServer(BLEAddress pAddress) {
   return true;
 }
 
-/**
- * @brief Task to perform connection
- * 
- * @param parameter Not used
- */
-void connect(void * parameter){
-  if (connectToServer(*pServerAddress)) {
-    Serial.println("Connected to BLE Server.");
-    screenManager.triggerEvent(Event::CONNECTION_FINISHED);
-  } else {
-    Serial.println("Failed to connect to the server.");
-    screenManager.triggerEvent(Event::CONNECTION_FAILED);
-  }
-  vTaskDelete(nullptr);
-}
-
-
 /**
  * @brief Scan for BLE servers and find the first one that advertises the service we are looking for.
  * 
@@ -406,37 +462,58 @@ class MyAdvertisedDeviceCallbacks: public BLEAdvertisedDeviceCallbacks {
     if (advertisedDevice.haveServiceUUID() && advertisedDevice.getServiceUUID().equals(homeEnvServiceUUID)) {
       Serial.print("Found device ");
       Serial.println(millis() - scanStartTime);
+      deviceFound = true;
+      memcpy(serverAddress, *advertisedDevice.getAddress().getNative(), sizeof(esp_bd_addr_t));
       advertisedDevice.getScan()->stop();
-      pServerAddress = new BLEAddress(advertisedDevice.getAddress());
-      xTaskCreate(connect, "connect", 4096, nullptr, 0, nullptr);
     } // Found server
   }   // onResult
 };    // MyAdvertisedDeviceCallbacks
 
 /**
- * @brief Task to perform BLE scan
+ * @brief Task to synchronize with the BLE server: scan, connect and transfer data.
+ *  The new status is drawn with a single refresh after Event::CONNECTION_FINISHED.
+ *  While connected, the task executes the commands of other tasks until deep sleep.
  * 
  * @param parameter Not used
  */
-void scan(void * parameter){
+static void bleSync(void * parameter){
+  static MyAdvertisedDeviceCallbacks advertisedDeviceCallbacks;
   BLEDevice::init(""); 
   Serial.println("Enter scan"); 
   BLEScan* pBLEScan = BLEDevice::getScan();
-  pBLEScan->setAdvertisedDeviceCallbacks(new MyAdvertisedDeviceCallbacks());
+  pBLEScan->setAdvertisedDeviceCallbacks(&advertisedDeviceCallbacks);
   pBLEScan->setActiveScan(false);
   scanStartTime = millis();
   pBLEScan->start(2);
+  bool connected = false;
+  if (!deviceFound){
+    Serial.println("No BLE server found");
+  } else if (connectToServer(BLEAddress(serverAddress))) {
+    Serial.println("Connected to BLE Server.");
+    connected = true;
+    screenManager.triggerEvent(Event::CONNECTION_FINISHED);
+  } else {
+    Serial.println("Failed to connect to the server.");
+    screenManager.triggerEvent(Event::CONNECTION_FAILED);
+  }
+  telemetryStack(TASK_SYNC);
+  powerRelease(WORK_BLE);
+  while (connected){
+    xSemaphoreTake(commandSemaphore, portMAX_DELAY);
+    powerAcquire(WORK_BLE);
+    writePending();
+    powerRelease(WORK_BLE);
+  }
   vTaskDelete(nullptr);
 }
 
 
 /**
- * @brief Start BLE scan
+ * @brief Start BLE synchronization. The device stays awake until the connection is finished.
  * 
  */
 void BLEscan () {
-  xTaskCreate(scan, "scan", 2048, nullptr, 0, nullptr);
+  powerAcquire(WORK_BLE);
+  commandSemaphore = xSemaphoreCreateBinaryStatic(&commandSemaphoreBuffer);
+  xTaskCreateStatic(bleSync, "sync", SYNC_STACK_SIZE, nullptr, 0, syncStack, &syncTaskBuffer);
 }
-
-
-
@@ -16,8 +16,10 @@
 #define _BTCOM_H_
 
 #include <BLEDevice.h>
-
-enum class Room : uint8_t  {LIVINGROOM, DININGROOM, KITCHEN, BEDROOM, BATHROOM_GF, CORRIDOR_GF, BATHROOM_UF, CORRIDOR_UF, SVENJA, ROBIN, LAST};
+#include "rooms.h"
+#include "timetable.h"
+#include "garbage.h"
+#include "history.h"
 
 enum GarbageType {ORGANIC, RESIDUAL, PAPER, PLASTIC, UNDEFINED};
 struct Garbage {
@@ -33,13 +35,47 @@ struct Schedule {
   struct {uint16_t line:13; enum Transport type:3;};
 };
 
-struct Garbage getNextGarbageCollection();
-struct Schedule* getBusTimeTable();
-float getTemperature();
-uint8_t getHumidity();
-float getOutdoorTemperature();
-uint8_t getOutdoorHumidity();
-uint8_t* getWindows();
+// time of reception of status fields
+enum StatusField : uint8_t {FIELD_TEMPERATURE, FIELD_HUMIDITY, FIELD_OUTDOOR_TEMPERATURE, FIELD_OUTDOOR_HUMIDITY, 
+  FIELD_WINDOWS, FIELD_BUS, FIELD_GARBAGE, FIELD_COUNT};
+
+#define PM_INVALID 99
+
+/**
+ * @brief Status received from the home environment service. Published as a whole after each connection.
+ * 
+ */
+struct Status {
+  uint32_t version;                   // incremented with each published status
+  float temperature;
+  uint8_t humidity;
+  float outdoorTemperature;
+  uint8_t outdoorHumidity;
+  uint8_t windows[ROOMS_MAX/4];       // 2 bits per room as in enum WindowState
+  uint8_t roomCount;                  // rooms of window state
+  struct Schedule busTimeTable[TIMETABLE_NEXT];
+  uint8_t busCount;                   // departures in busTimeTable
+  struct Garbage nextGarbageCollection;
+  time_t received[FIELD_COUNT];       // time of last reception per field, 0 if never received
+};
+
+/**
+ * @brief Consistent copy of the received data to draw all bands of a frame.
+ * 
+ */
+struct Snapshot {
+  struct Status status;
+  struct Timetable timetable;
+  struct GarbageCalendar garbage;
+  struct History history;
+  struct RoomRegistry rooms;
+};
+
+// protects the received data in the RTC state, written by the sync task
+extern portMUX_TYPE statusMux;
+
+struct Status getStatus();
+void getSnapshot(struct Snapshot* snapshot);
 void writePartyMode(uint8_t hour, uint8_t minute);
 bool partyModeWritten();
 void writeHomeMode(boolean home);
@@ -47,6 +83,5 @@ bool homeModeWritten();
 void writeAudioMode(boolean on);
 bool audioModeWritten();
 void BLEscan(void);
-void connect();
 
-#endif
+#endif
@@ -2,7 +2,7 @@
  * @file configuration.h
  * @author Christof Menzenbach
  * @date 9 Feb 2018
- * @brief Configuration of touch inputs, touch thresholds and communication interval.
+ * @brief Configuration of touch inputs, touch thresholds, communication and clock update interval.
  *
  */
  
@@ -14,14 +14,48 @@
 #define BUTTON_RM T9
 #define BUTTON_R T8
 
+// initial touch thresholds until the baseline of the pad is calibrated
 #define BUTTON_L_TH 60
 #define BUTTON_LM_TH 60
 #define BUTTON_RM_TH 65
 #define BUTTON_R_TH 70
 
+// touch threshold in percent of the pad baseline, weight of baseline tracking and filter period in ms
+#define TOUCH_THRESHOLD 70
+#define TOUCH_BASELINE_WEIGHT 8
+#define TOUCH_FILTER_PERIOD 10
+// filter periods until the first baseline sample and ms between baseline samples of a released pad
+#define TOUCH_CALIBRATE_DELAY 4
+#define TOUCH_CALIBRATE_INTERVAL 1000
+// samples and sample interval in ms to confirm a touch wakeup
+#define TOUCH_CONFIRM_SAMPLES 5
+#define TOUCH_CONFIRM_INTERVAL 8
+
+
+// render screens in bands of BAND_ROWS rows instead of a full framebuffer to save RAM for BLE
+//#define BANDED_RENDERING
+#define BAND_ROWS 40
+
+// refresh policy against ghosting: full refresh of a screen region after number of partial refreshes 
+// or changed pixels in multiples of region size. Double refresh if percentage of pixels changed.
+#define MAX_PARTIAL_REFRESHES 200
+#define MAX_GHOSTING 40
+#define DOUBLE_REFRESH_CHANGE 30
+// hour of day for daily full refresh
+#define CLEANUP_HOUR 3
+
+// ms without any activity until deep sleep is entered, e.g. if the BLE server does not respond
+#define AWAKE_TIMEOUT 60000
 
 // duration between BLE communication for dedicated hour of day for battery saving
 //                                 0   1   2   3   4   5   6   7   8   9  10  11  12  13  14  15  16  17  18  19  20  21  22  23  24
 const uint8_t commIntervalls[] = {10, 10, 15, 20, 30, 30, 10,  2,  2,  5,  5, 10,  5,  3,  5,  5,  5,  5,  3,  4,  4,  4,  4,  4, 10};
 
-#endif
+// hours between time synchronizations with the server after RTC drift is estimated
+#define TIME_SYNC_INTERVAL 12
+
+// minutes between clock updates for dedicated hour of day. Wakeups in between are handled by the wake stub without boot
+//                                 0   1   2   3   4   5   6   7   8   9  10  11  12  13  14  15  16  17  18  19  20  21  22  23  24
+const uint8_t clockIntervalls[] = { 1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1};
+
+#endif
@@ -0,0 +1,315 @@
+/**
+ * @file display.cpp
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Driver layer for the 4.2" e-ink display.
+ *
+ * - Image data is sent in SPI bursts instead of single bytes
+ * - Refresh does not block. End of refresh is signaled by the BUSY pin interrupt
+ *   and notified to the screen manager by Event::DISPLAY_READY. Light sleep is locked while refreshing
+ * - Partial refresh of windows
+ * - Waveform LUT profiles, selected by the refresh policy. The LUT is only sent if the profile changes
+ */
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <epd4in2.h>
+#include <FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_pm.h>
+#include "display.h"
+#include "framestore.h"
+#include "hmi.h"
+
+#define EPD_SPI_FREQUENCY 10000000
+#define REFRESH_TIMEOUT 5000        // ticks to wait for end of refresh before the display is assumed to be idle
+
+Epd epd;
+boolean firstBoot;
+boolean partialRefresh = false;
+volatile boolean refreshing = false;
+SemaphoreHandle_t idleSemaphore = nullptr;
+StaticSemaphore_t idleSemaphoreBuffer;
+#if CONFIG_PM_ENABLE
+esp_pm_lock_handle_t refreshLock = nullptr;      // no light sleep while BUSY is monitored
+#endif
+boolean lutLoaded = false;
+Waveform lutWaveform;
+
+// Ultra-fast LUT: single short phase per pixel. Old data is not used, so unchanged pixels are driven to their 
+// color as well. This stresses them with each refresh, which is limited by MAX_PARTIAL_REFRESHES.
+const unsigned char lut_vcom0_fast[] = {
+  0x00, 0x06, 0x00, 0x00, 0x00, 0x01,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00};
+const unsigned char lut_white_fast[] = {
+  0xA0, 0x06, 0x00, 0x00, 0x00, 0x01,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+const unsigned char lut_black_fast[] = {
+  0x50, 0x06, 0x00, 0x00, 0x00, 0x01,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+/**
+ * @brief Interrupt handler for rising edge of BUSY pin at the end of a refresh.
+ * 
+ */
+static void IRAM_ATTR busyIsr(){
+  if (refreshing){
+    BaseType_t woken = pdFALSE;
+    refreshing = false;
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_release(refreshLock);
+#endif
+    xSemaphoreGiveFromISR(idleSemaphore, &woken);
+    screenManager.triggerEventFromISR(Event::DISPLAY_READY, &woken);
+    if (woken){
+      portYIELD_FROM_ISR();
+    }
+  }
+}
+
+/**
+ * @brief Send a block of data to the display in one SPI burst.
+ * 
+ * @param data 
+ * @param length 
+ */
+static void sendData(const uint8_t* data, uint32_t length){
+  digitalWrite(DC_PIN, HIGH);
+  digitalWrite(CS_PIN, LOW);
+  SPI.writeBytes((uint8_t*)data, length);
+  digitalWrite(CS_PIN, HIGH);
+}
+
+/**
+ * @brief Set window for partial data transmission or partial refresh.
+ * 
+ * @param x Left column of window, multiple of 8.
+ * @param y Top row of window.
+ * @param w Width of window, multiple of 8.
+ * @param h Height of window.
+ */
+static void setPartialWindow(uint16_t x, uint16_t y, uint16_t w, uint16_t h){
+  epd.SendCommand(PARTIAL_WINDOW);
+  epd.SendData(x >> 8);
+  epd.SendData(x & 0xf8);
+  epd.SendData((x + w - 1) >> 8);
+  epd.SendData(((x + w - 1) & 0xf8) | 0x07);
+  epd.SendData(y >> 8);
+  epd.SendData(y & 0xff);
+  epd.SendData((y + h - 1) >> 8);
+  epd.SendData((y + h - 1) & 0xff);
+  epd.SendData(0x01);         // gates scan inside and outside of the partial window
+}
+
+/**
+ * @brief Send a LUT to the display.
+ * 
+ * @param command LUT register.
+ * @param lut 
+ * @param length 
+ */
+static void sendLut(uint8_t command, const unsigned char* lut, uint32_t length){
+  epd.SendCommand(command);
+  sendData(lut, length);
+}
+
+/**
+ * @brief Load the LUT of a waveform profile, if it is not loaded yet.
+ * 
+ * @param waveform 
+ */
+static void setWaveform(Waveform waveform){
+  if (lutLoaded && lutWaveform == waveform){
+    return;
+  }
+  switch (waveform){
+    case Waveform::FAST:
+      sendLut(LUT_FOR_VCOM, lut_vcom0_fast, sizeof(lut_vcom0_fast));
+      sendLut(LUT_WHITE_TO_WHITE, lut_white_fast, sizeof(lut_white_fast));
+      sendLut(LUT_BLACK_TO_WHITE, lut_white_fast, sizeof(lut_white_fast));
+      sendLut(LUT_WHITE_TO_BLACK, lut_black_fast, sizeof(lut_black_fast));
+      sendLut(LUT_BLACK_TO_BLACK, lut_black_fast, sizeof(lut_black_fast));
+    break;
+    case Waveform::BALANCED:
+      epd.SetLutQuick();
+    break;
+    case Waveform::FULL:
+      epd.SetLut();
+    break;
+  }
+  lutWaveform = waveform;
+  lutLoaded = true;
+}
+
+/**
+ * @brief Start refresh. Has to be called in partial mode to refresh a window only.
+ * 
+ * @param waveform Waveform profile of refresh.
+ */
+static void startRefresh(Waveform waveform){
+  refreshing = true;
+#if CONFIG_PM_ENABLE
+  esp_pm_lock_acquire(refreshLock);
+#endif
+  xSemaphoreTake(idleSemaphore, 0);
+  setWaveform(waveform);
+  epd.SendCommand(DISPLAY_REFRESH);
+  firstBoot = false;
+}
+
+/**
+ * @brief Leave partial refresh mode after refresh of a window is finished.
+ * 
+ */
+static void leavePartialRefresh(){
+  if (partialRefresh){
+    displayWaitIdle();
+    epd.SendCommand(PARTIAL_OUT);
+    partialRefresh = false;
+  }
+}
+
+/**
+ * @brief Init display. Clear display after first boot, not after wakeup from deep sleep. 
+ * 
+ * @param first True if first boot. False if wakeup from deep sleep.
+ */
+void displayInit (boolean first){
+  Serial.println("e-Paper init");
+  firstBoot = first;
+  if (idleSemaphore == nullptr){
+    idleSemaphore = xSemaphoreCreateBinaryStatic(&idleSemaphoreBuffer);
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "refresh", &refreshLock);
+#endif
+  }
+  lutLoaded = false;
+  if (epd.Init() != 0) {
+    Serial.println("e-Paper init failed");
+    return;
+  }
+  // the display interface keeps its SPI transaction open, restart it with higher frequency
+  SPI.endTransaction();
+  SPI.beginTransaction(SPISettings(EPD_SPI_FREQUENCY, MSBFIRST, SPI_MODE0));
+  attachInterrupt(digitalPinToInterrupt(BUSY_PIN), busyIsr, RISING);
+  if (first) {
+    frameInvalidate();
+    epd.ClearFrame();
+    epd.DisplayFrame(); 
+    lutLoaded = false;    // full LUT loaded by the display library
+  } 
+}
+
+/**
+ * @brief Check if display is refreshing.
+ * 
+ * @return true Refresh is running, display does not accept data.
+ * @return false Display is idle.
+ */
+bool displayBusy(){
+  return refreshing;
+}
+
+/**
+ * @brief Wait until a running refresh is finished. The task is blocked until the BUSY interrupt occurs.
+ * 
+ */
+void displayWaitIdle(){
+  if (refreshing && xSemaphoreTake(idleSemaphore, REFRESH_TIMEOUT) == pdFALSE){
+    Serial.println("e-Paper refresh timeout");
+    refreshing = false;
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_release(refreshLock);
+#endif
+  }
+}
+
+/**
+ * @brief Write rows of an image to display memory without refresh. Writes old and new data after first boot.
+ * 
+ * @param image Image of rows.
+ * @param y First row.
+ * @param w Width of rows.
+ * @param h Number of rows.
+ */
+void displayWrite(const uint8_t* image, uint16_t y, uint16_t w, uint16_t h){
+  leavePartialRefresh();
+  displayWaitIdle();
+  epd.SendCommand(PARTIAL_IN);
+  setPartialWindow(0, y, w, h);
+  if (firstBoot){
+    epd.SendCommand(DATA_START_TRANSMISSION_1);
+    sendData(image, w/8*h);
+  }
+  epd.SendCommand(DATA_START_TRANSMISSION_2);
+  sendData(image, w/8*h);
+  delay(2);
+  epd.SendCommand(PARTIAL_OUT);
+}
+
+/**
+ * @brief Refresh rows with the data in display memory. Does not wait until refresh is finished.
+ * 
+ * @param y First row.
+ * @param h Number of rows.
+ * @param waveform Waveform profile of refresh.
+ */
+void displayRefresh(uint16_t y, uint16_t h, Waveform waveform){
+  leavePartialRefresh();
+  displayWaitIdle();
+  if (y > 0 || y + h < EPD_HEIGHT - 1){
+    epd.SendCommand(PARTIAL_IN);
+    setPartialWindow(0, y, EPD_WIDTH, h);
+    partialRefresh = true;
+  }
+  startRefresh(waveform);
+}
+
+/**
+ * @brief Send image of a window to display device and refresh only this window. 
+ *  Does not wait until refresh is finished.
+ * 
+ * @param image Window image.
+ * @param x Left column of window, multiple of 8.
+ * @param y Top row of window.
+ * @param w Width of window, multiple of 8.
+ * @param h Height of window.
+ * @param waveform Waveform profile of refresh.
+ */
+void displayWindow(const uint8_t* image, uint16_t x, uint16_t y, uint16_t w, uint16_t h, Waveform waveform){
+  leavePartialRefresh();
+  displayWaitIdle();
+  epd.SendCommand(PARTIAL_IN);
+  setPartialWindow(x, y, w, h);
+  epd.SendCommand(DATA_START_TRANSMISSION_2);
+  sendData(image, w/8*h);
+  partialRefresh = true;
+  startRefresh(waveform);
+}
+
+/**
+ * @brief Switch display off to minimize current consumption.
+ * 
+ */
+void displayOff (){
+  leavePartialRefresh();
+  displayWaitIdle();
+  detachInterrupt(digitalPinToInterrupt(BUSY_PIN));
+  epd.Sleep();
+}
@@ -0,0 +1,32 @@
+/**
+ * @file display.h
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Driver layer for the 4.2" e-ink display.
+ *
+ */
+
+#ifndef _DISPLAY_H_
+#define _DISPLAY_H_
+
+#include <Arduino.h>
+
+/**
+ * @brief Waveform LUT profiles. Faster waveforms leave more ghosting.
+ * 
+ */
+enum class Waveform : uint8_t {
+  FAST,         // single short phase driving all pixels of the window to their new color, for the clock digits
+  BALANCED,     // quick waveform of the display library for data updates
+  FULL          // full waveform to remove ghosting
+};
+
+void displayInit (bool first);
+void displayWrite(const uint8_t* image, uint16_t y, uint16_t w, uint16_t h);
+void displayRefresh(uint16_t y, uint16_t h, Waveform waveform = Waveform::BALANCED);
+void displayWindow(const uint8_t* image, uint16_t x, uint16_t y, uint16_t w, uint16_t h, Waveform waveform = Waveform::FAST);
+bool displayBusy(void);
+void displayWaitIdle(void);
+void displayOff(void);
+
+#endif
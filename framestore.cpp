@@ -0,0 +1,299 @@
+/**
+ * @file framestore.cpp
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Compressed copy of the displayed frame in RTC memory.
+ *
+ * The frame shown on the display is kept across deep sleep to refresh only changed rows after wakeup.
+ * - Each row is XOR coded with the previous row, so uniform areas and vertical edges result in zeros
+ * - XOR coded rows are run length encoded. Runs do not exceed a row, which allows decoding row by row
+ * - Rows exceeding the RTC memory budget are not stored and are handled as changed
+ * - Compressed frame is protected by a CRC
+ * - A new frame can be passed in bands, it is compared and encoded in one pass. Without banded rendering,
+ *   the frame is passed at once and encoded into RTC memory after the comparison, which saves the buffer.
+ */
+
+#include <Arduino.h>
+#include <rom/crc.h>
+#include "configuration.h"
+#include "framestore.h"
+
+#define MAX_LITERAL 128
+#define MIN_RUN 3
+#define MAX_RUN (127+MIN_RUN)
+
+struct FrameHeader {
+  uint16_t width;     // bytes per row, 0 if invalid
+  uint16_t rows;      // number of stored rows
+  uint16_t size;      // size of compressed data
+  uint16_t reserved;
+};
+
+struct FrameStore {
+  struct FrameHeader header;
+  uint32_t crc;
+  uint8_t data[FRAME_STORE_SIZE];
+};
+
+/**
+ * @brief State of comparing and encoding a new frame.
+ * 
+ */
+struct FrameCommit {
+  uint16_t width;
+  uint16_t rows;
+  uint16_t row;                           // next row of new frame
+  uint16_t storedRows;                    // rows of new frame fitting into RTC memory
+  uint16_t size;                          // size of encoded new frame
+  bool storing;
+  bool decoding;
+  bool changed;
+  uint16_t first;
+  uint16_t last;
+  const uint8_t* in;                      // next encoded row of stored frame
+  const uint8_t* end;
+  uint8_t previousOld[FRAME_MAX_WIDTH];   // previous row of stored frame
+  uint8_t previousNew[FRAME_MAX_WIDTH];   // previous row of new frame
+};
+
+RTC_DATA_ATTR struct FrameStore frame;
+static struct FrameCommit commit;
+#ifdef BANDED_RENDERING
+static uint8_t encoded[FRAME_STORE_SIZE]; // new frame is encoded here while stored frame is decoded
+#else
+static uint8_t* const encoded = frame.data; // new frame is encoded in place after comparison
+#endif
+static uint16_t rowPixels[FRAME_MAX_ROWS];  // changed pixels per row of last frame
+
+/**
+ * @brief Calculate CRC of header and compressed data.
+ * 
+ * @return uint32_t 
+ */
+static uint32_t frameCrc(){
+  uint32_t crc = crc32_le(0, (const uint8_t*)&frame.header, sizeof(frame.header));
+  return crc32_le(crc, frame.data, frame.header.size);
+}
+
+/**
+ * @brief Run length encoding of a row. A control byte < 0x80 is followed by control+1 literal bytes, 
+ *  a control byte >= 0x80 is followed by one byte which is repeated (control&0x7f)+MIN_RUN times.
+ * 
+ * @param row Row data.
+ * @param width Bytes of row.
+ * @param out Destination of encoded data.
+ * @param space Available space at destination.
+ * @return uint16_t Size of encoded data, 0 if space is exceeded.
+ */
+static uint16_t encodeRow(const uint8_t* row, uint16_t width, uint8_t* out, uint16_t space){
+  uint16_t size = 0;
+  uint16_t i = 0;
+  while (i < width){
+    uint16_t run = 1;
+    while (i + run < width && row[i+run] == row[i] && run < MAX_RUN){
+      run++;
+    }
+    if (run >= MIN_RUN){
+      if (size + 2 > space){
+        return 0;
+      }
+      out[size++] = 0x80 | (run - MIN_RUN);
+      out[size++] = row[i];
+      i += run;
+    } else {
+      // collect literals until next run starts
+      uint16_t start = i;
+      while (i < width && i - start < MAX_LITERAL){
+        if (i + 2 < width && row[i] == row[i+1] && row[i] == row[i+2]){
+          break;
+        }
+        i++;
+      }
+      uint16_t count = i - start;
+      if (size + 1 + count > space){
+        return 0;
+      }
+      out[size++] = count - 1;
+      memcpy(out + size, row + start, count);
+      size += count;
+    }
+  }
+  return size;
+}
+
+/**
+ * @brief Decode a run length encoded row.
+ * 
+ * @param in Encoded data. Will point to the following row after decoding.
+ * @param end End of encoded data.
+ * @param row Destination of row data.
+ * @param width Bytes of row.
+ * @return true Row decoded.
+ * @return false Encoded data is corrupted.
+ */
+static bool decodeRow(const uint8_t** in, const uint8_t* end, uint8_t* row, uint16_t width){
+  const uint8_t* p = *in;
+  uint16_t i = 0;
+  while (i < width){
+    if (p >= end){
+      return false;
+    }
+    uint8_t control = *p++;
+    if (control & 0x80){
+      uint16_t run = (control & 0x7f) + MIN_RUN;
+      if (p >= end || i + run > width){
+        return false;
+      }
+      memset(row + i, *p++, run);
+      i += run;
+    } else {
+      uint16_t count = control + 1;
+      if (p + count > end || i + count > width){
+        return false;
+      }
+      memcpy(row + i, p, count);
+      p += count;
+      i += count;
+    }
+  }
+  *in = p;
+  return true;
+}
+
+/**
+ * @brief Start comparing a new frame with the stored frame. The new frame is passed row by row by frameRows().
+ * 
+ * @param width Bytes per row.
+ * @param rows Number of rows.
+ */
+void frameBegin(uint16_t width, uint16_t rows){
+  commit.width = width;
+  commit.rows = rows;
+  commit.row = 0;
+  commit.size = 0;
+  commit.storing = width <= FRAME_MAX_WIDTH;
+  commit.changed = false;
+  commit.first = 0;
+  commit.last = rows - 1;
+  commit.in = frame.data;
+  commit.end = frame.data + frame.header.size;
+  commit.decoding = commit.storing && frame.header.width == width && 
+    frame.header.size <= FRAME_STORE_SIZE && frame.crc == frameCrc();
+  memset(commit.previousOld, 0, sizeof(commit.previousOld));
+  memset(commit.previousNew, 0, sizeof(commit.previousNew));
+}
+
+/**
+ * @brief Compare the next rows of the new frame with the stored frame and encode them.
+ *  Without banded rendering, all rows have to be passed in a single call.
+ * 
+ * @param image Rows of the new frame.
+ * @param count Number of rows.
+ */
+void frameRows(const uint8_t* image, uint16_t count){
+  uint8_t row[FRAME_MAX_WIDTH];
+  uint16_t width = commit.width;
+  uint16_t start = commit.row;
+  for (uint16_t r=0; r<count && commit.row<commit.rows; r++, commit.row++){
+    const uint8_t* current = image + r*width;
+    bool rowChanged = true;
+    commit.decoding = commit.decoding && commit.row < frame.header.rows && 
+      decodeRow(&commit.in, commit.end, row, width);
+    if (commit.decoding){
+      for (int i=0; i<width; i++){
+        row[i] ^= commit.previousOld[i];
+      }
+      memcpy(commit.previousOld, row, width);
+      uint16_t pixels = 0;
+      for (int i=0; i<width; i++){
+        pixels += __builtin_popcount(row[i] ^ current[i]);
+      }
+      rowChanged = pixels > 0;
+      if (commit.row < FRAME_MAX_ROWS){
+        rowPixels[commit.row] = pixels;
+      }
+    } else if (commit.row < FRAME_MAX_ROWS){
+      rowPixels[commit.row] = width*8;
+    }
+    if (rowChanged){
+      if (!commit.changed){
+        commit.first = commit.row;
+        commit.changed = true;
+      }
+      commit.last = commit.row;
+    }
+  }
+#ifndef BANDED_RENDERING
+  if (!commit.changed){
+    return;     // stored frame is kept
+  }
+  frame.header.width = 0;   // stored frame is overwritten
+#endif
+  for (uint16_t r=0; r<commit.row-start && commit.storing; r++){
+    const uint8_t* current = image + r*width;
+    for (int i=0; i<width; i++){
+      row[i] = current[i] ^ commit.previousNew[i];
+    }
+    memcpy(commit.previousNew, current, width);
+    uint16_t rowSize = encodeRow(row, width, encoded + commit.size, FRAME_STORE_SIZE - commit.size);
+    if (rowSize == 0){
+      commit.storing = false;  // RTC memory budget exceeded, following rows are not stored
+      commit.storedRows = start + r;
+    } else {
+      commit.size += rowSize;
+    }
+  }
+  if (commit.storing){
+    commit.storedRows = commit.row;
+  }
+}
+
+/**
+ * @brief Finish comparison of new frame and store it in RTC memory, if it changed.
+ * 
+ * @param first First changed row.
+ * @param last Last changed row.
+ * @return true Frame changed. All rows are changed if no valid frame was stored.
+ * @return false Frame is unchanged.
+ */
+bool frameEnd(uint16_t* first, uint16_t* last){
+  *first = commit.first;
+  *last = commit.last;
+  if (commit.changed){
+    frame.header.width = 0;
+    if (commit.width <= FRAME_MAX_WIDTH){
+#ifdef BANDED_RENDERING
+      memcpy(frame.data, encoded, commit.size);
+#endif
+      frame.header.width = commit.width;
+      frame.header.rows = commit.storedRows;
+      frame.header.size = commit.size;
+      frame.header.reserved = 0;
+      frame.crc = frameCrc();
+    }
+  }
+  return commit.changed;
+}
+
+/**
+ * @brief Get number of changed pixels of the last frame passed by frameRows().
+ * 
+ * @param first First row.
+ * @param last Last row.
+ * @return uint32_t Changed pixels.
+ */
+uint32_t frameChangedPixels(uint16_t first, uint16_t last){
+  uint32_t pixels = 0;
+  for (uint16_t row=first; row<=last && row<FRAME_MAX_ROWS; row++){
+    pixels += rowPixels[row];
+  }
+  return pixels;
+}
+
+/**
+ * @brief Invalidate stored frame, e.g. after the display is cleared.
+ * 
+ */
+void frameInvalidate(){
+  frame.header.width = 0;
+}
@@ -0,0 +1,24 @@
+/**
+ * @file framestore.h
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Compressed copy of the displayed frame in RTC memory.
+ *
+ */
+
+#ifndef _FRAMESTORE_H_
+#define _FRAMESTORE_H_
+
+#include <Arduino.h>
+
+#define FRAME_STORE_SIZE 4096     // bytes of RTC slow memory for compressed frame
+#define FRAME_MAX_WIDTH 64        // max bytes per row
+#define FRAME_MAX_ROWS 300        // max rows with changed pixel count
+
+void frameBegin(uint16_t width, uint16_t rows);
+void frameRows(const uint8_t* image, uint16_t count);
+bool frameEnd(uint16_t* first, uint16_t* last);
+uint32_t frameChangedPixels(uint16_t first, uint16_t last);
+void frameInvalidate();
+
+#endif
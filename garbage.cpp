@@ -0,0 +1,114 @@
+/**
+ * @file garbage.cpp
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Calendar of garbage collections to count down the days locally.
+ *
+ * The server sends the collection dates of the next months in a rare bulk transfer. 
+ * The days until collection are calculated from the current date with every draw.
+ * 
+ * Encoding:
+ * - 2 bytes year, 1 byte month, 1 byte day of the first date as in GATT date time
+ * - 1 byte per day, bit n set if garbage type n is collected
+ */
+
+#include <Arduino.h>
+#include <TimeLib.h>
+#include "btcom.h"
+#include "rtcstate.h"
+#include "garbage.h"
+
+#define GARBAGE_HEADER 4
+
+/**
+ * @brief Store received calendar in the RTC state. Called by the sync task.
+ * 
+ * @param data Encoded calendar.
+ * @param length 
+ */
+void garbageStore(const uint8_t* data, uint16_t length){
+  struct GarbageCalendar* calendar = &rtcState.garbage;
+  if (length <= GARBAGE_HEADER || data[2] < 1 || data[2] > 12 || data[3] < 1 || data[3] > 31){
+    Serial.println("Invalid garbage calendar");
+    return;
+  }
+  tmElements_t tm = {0, 0, 0, 0, data[3], data[2], (uint8_t)CalendarYrToTm(data[0] | data[1] << 8)};
+  time_t start = makeTime(tm);
+  uint16_t days = min(length - GARBAGE_HEADER, GARBAGE_DAYS);
+  portENTER_CRITICAL(&statusMux);
+  memset(calendar->days, 0, GARBAGE_DAYS);
+  memcpy(calendar->days, data + GARBAGE_HEADER, days);
+  calendar->start = start;
+  calendar->covered = days;
+  portEXIT_CRITICAL(&statusMux);
+}
+
+/**
+ * @brief Get index of day in calendar.
+ * 
+ * @param calendar 
+ * @param time 
+ * @return int32_t Index, may be outside of calendar.
+ */
+static int32_t dayIndex(const struct GarbageCalendar* calendar, time_t time){
+  return ((int32_t)previousMidnight(time) - (int32_t)calendar->start)/(int32_t)SECS_PER_DAY;
+}
+
+/**
+ * @brief Check if the calendar has to be requested from the server. Called by the sync task.
+ * 
+ * @param time Current time.
+ * @return true Calendar invalid or covers less than GARBAGE_REFRESH_DAYS from today.
+ */
+bool garbageRefreshDue(time_t time){
+  int32_t index = dayIndex(&rtcState.garbage, time);
+  return rtcState.garbage.start == 0 || index < 0 || index + GARBAGE_REFRESH_DAYS > rtcState.garbage.covered;
+}
+
+/**
+ * @brief Days until next collection of a garbage type.
+ * 
+ * @param calendar Stored calendar or snapshot.
+ * @param time Current time.
+ * @param type Garbage type.
+ * @return uint8_t Days, 255 if unknown or not within the received days.
+ */
+uint8_t garbageDays(const struct GarbageCalendar* calendar, time_t time, uint8_t type){
+  int32_t index = dayIndex(calendar, time);
+  if (calendar->start == 0 || index < 0){
+    return 255;
+  }
+  for (int32_t i=index; i<calendar->covered; i++){
+    if (calendar->days[i] & 1 << type){
+      return i - index;
+    }
+  }
+  return 255;
+}
+
+/**
+ * @brief Get next garbage collection from calendar. Without calendar, the last received collection is counted down.
+ * 
+ * @param calendar Stored calendar or snapshot.
+ * @param time Current time.
+ * @param status Last received status.
+ * @return struct Garbage 
+ */
+struct Garbage garbageNext(const struct GarbageCalendar* calendar, time_t time, const struct Status* status){
+  struct Garbage next = {GarbageType::UNDEFINED, 255};
+  for (uint8_t type=ORGANIC; type<UNDEFINED; type++){
+    uint8_t days = garbageDays(calendar, time, type);
+    if (days < next.days){
+      next.type = (enum GarbageType)type;
+      next.days = days;
+    }
+  }
+  if (next.type == GarbageType::UNDEFINED && status->nextGarbageCollection.days != 255 && status->received[FIELD_GARBAGE] != 0){
+    int32_t elapsed = (previousMidnight(time) - previousMidnight(status->received[FIELD_GARBAGE]))/SECS_PER_DAY;
+    if (elapsed >= 0 && elapsed <= status->nextGarbageCollection.days){
+      next.type = status->nextGarbageCollection.type;
+      next.days = status->nextGarbageCollection.days - elapsed;
+    }
+  }
+  return next;
+}
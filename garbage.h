@@ -0,0 +1,35 @@
+/**
+ * @file garbage.h
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Calendar of garbage collections to count down the days locally.
+ *
+ */
+
+#ifndef _GARBAGE_H_
+#define _GARBAGE_H_
+
+#include <Arduino.h>
+#include <TimeLib.h>
+
+#define GARBAGE_DAYS 120          // days of calendar
+#define GARBAGE_REFRESH_DAYS 30   // calendar is requested again, if it covers less remaining days
+
+/**
+ * @brief Calendar of garbage collections. One byte per day with a bit per garbage type.
+ * 
+ */
+struct GarbageCalendar {
+  time_t start;                   // midnight of first day, 0 if invalid
+  uint8_t covered;                // days received
+  uint8_t days[GARBAGE_DAYS];
+};
+
+struct Status;
+
+void garbageStore(const uint8_t* data, uint16_t length);
+bool garbageRefreshDue(time_t time);
+uint8_t garbageDays(const struct GarbageCalendar* calendar, time_t time, uint8_t type);
+struct Garbage garbageNext(const struct GarbageCalendar* calendar, time_t time, const struct Status* status);
+
+#endif
@@ -0,0 +1,116 @@
+/**
+ * @file history.cpp
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief History of temperature and humidity for sparklines.
+ *
+ * Samples are taken from the status of each synchronization, the latest per 10 minutes is kept 
+ * in a ring buffer of the RTC state. Sample encoding in 32 bits:
+ * - bits 0..8 temperature in 0.1 °C, 0..51.1 °C
+ * - bits 9..18 outdoor temperature in 0.1 °C, -40..62.3 °C
+ * - bits 19..24 humidity in 2 %
+ * - bits 25..30 outdoor humidity in 2 %
+ * - bit 31 sample valid
+ */
+
+#include <Arduino.h>
+#include "btcom.h"
+#include "rtcstate.h"
+#include "history.h"
+
+#define SAMPLE_VALID 0x80000000
+#define OUTDOOR_OFFSET 400
+
+/**
+ * @brief Field of sample encoding.
+ * 
+ */
+struct Field {
+  uint8_t shift;
+  uint8_t bits;
+  int16_t offset;       // value of 0 in 0.1 units
+  uint8_t scale;        // 0.1 units per step
+};
+
+static const struct Field fields[] = {
+  {0, 9, 0, 1},                   // HISTORY_TEMPERATURE
+  {19, 6, 0, 20},                 // HISTORY_HUMIDITY
+  {9, 10, -OUTDOOR_OFFSET, 1},    // HISTORY_OUTDOOR_TEMPERATURE
+  {25, 6, 0, 20}                  // HISTORY_OUTDOOR_HUMIDITY
+};
+
+/**
+ * @brief Encode a value into its field. Values outside of the range are limited.
+ * 
+ * @param series 
+ * @param value Value in 0.1 units.
+ * @return uint32_t Encoded field.
+ */
+static uint32_t encode(uint8_t series, int32_t value){
+  const struct Field* field = &fields[series];
+  int32_t steps = (value - field->offset)/field->scale;
+  steps = constrain(steps, 0, (1 << field->bits) - 1);
+  return (uint32_t)steps << field->shift;
+}
+
+/**
+ * @brief Decode a value from a sample.
+ * 
+ * @param series 
+ * @param sample 
+ * @return int16_t Value in 0.1 units, HISTORY_INVALID if the sample is missing.
+ */
+static int16_t decode(uint8_t series, uint32_t sample){
+  if ((sample & SAMPLE_VALID) == 0){
+    return HISTORY_INVALID;
+  }
+  const struct Field* field = &fields[series];
+  return ((sample >> field->shift) & ((1 << field->bits) - 1))*field->scale + field->offset;
+}
+
+/**
+ * @brief Add status of synchronization to the RTC state. A sample of the same time slot is replaced, 
+ *  missing slots are marked invalid. Samples older than the newest one are dropped, e.g. after a clock correction.
+ * 
+ * @param time Time of synchronization.
+ * @param status 
+ */
+void historyAdd(time_t time, const struct Status* status){
+  struct History* history = &rtcState.history;
+  uint32_t slot = time/HISTORY_INTERVAL;
+  if (year(time) < 2016){
+    return;
+  }
+  uint32_t sample = SAMPLE_VALID | 
+    encode(HISTORY_TEMPERATURE, lround(status->temperature*10)) |
+    encode(HISTORY_HUMIDITY, status->humidity*10) |
+    encode(HISTORY_OUTDOOR_TEMPERATURE, lround(status->outdoorTemperature*10)) |
+    encode(HISTORY_OUTDOOR_HUMIDITY, status->outdoorHumidity*10);
+  portENTER_CRITICAL(&statusMux);
+  if (history->lastSlot == 0){
+    memset(history, 0, sizeof(struct History));
+    history->lastSlot = slot;
+  } 
+  if (slot >= history->lastSlot){
+    for (uint32_t i=0; i<min(slot - history->lastSlot, (uint32_t)HISTORY_SAMPLES); i++){
+      history->head = (history->head + 1)%HISTORY_SAMPLES;
+      history->samples[history->head] = 0;
+    }
+    history->lastSlot = slot;
+    history->samples[history->head] = sample;
+  }
+  portEXIT_CRITICAL(&statusMux);
+}
+
+/**
+ * @brief Get values of a series, oldest first and ending with the newest sample.
+ * 
+ * @param history Stored history or snapshot.
+ * @param series 
+ * @param values HISTORY_SAMPLES values in 0.1 units, HISTORY_INVALID for missing samples.
+ */
+void historySeries(const struct History* history, uint8_t series, int16_t* values){
+  for (uint16_t i=0; i<HISTORY_SAMPLES; i++){
+    values[i] = decode(series, history->samples[(history->head + 1 + i)%HISTORY_SAMPLES]);
+  }
+}
@@ -0,0 +1,36 @@
+/**
+ * @file history.h
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief History of temperature and humidity for sparklines.
+ *
+ */
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <Arduino.h>
+#include <TimeLib.h>
+
+#define HISTORY_SAMPLES 144           // 24 h
+#define HISTORY_INTERVAL 600          // s per sample
+#define HISTORY_INVALID INT16_MIN     // value of missing sample
+
+enum HistorySeries : uint8_t {HISTORY_TEMPERATURE, HISTORY_HUMIDITY, HISTORY_OUTDOOR_TEMPERATURE, HISTORY_OUTDOOR_HUMIDITY};
+
+/**
+ * @brief Ring buffer of bit packed samples.
+ * 
+ */
+struct History {
+  uint32_t lastSlot;                  // time slot of newest sample, 0 if empty
+  uint16_t head;                      // index of newest sample
+  uint32_t samples[HISTORY_SAMPLES];
+};
+
+struct Status;
+
+void historyAdd(time_t time, const struct Status* status);
+void historySeries(const struct History* history, uint8_t series, int16_t* values);
+
+#endif
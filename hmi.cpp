@@ -8,10 +8,8 @@
  */
 
 #include <TimeLib.h>
-#include <epd4in2.h>
 #include <Adafruit_GFX.h>
 #include <FreeRTOS.h>
-#include <freertos/timers.h>
 
 #include <Fonts/FreeMono12pt7b.h>
 #include <Fonts/FreeMono18pt7b.h>
@@ -26,46 +24,52 @@
 #include "configuration.h"
 #include "icons.h"
 #include "main.h"
+#include "framestore.h"
+#include "display.h"
+#include "refresh.h"
+#include "power.h"
+#include "telemetry.h"
+#include "timetable.h"
+#include "garbage.h"
+#include "history.h"
+#include "rooms.h"
 
 #define EPD_WHITE 0
 #define EPD_BLACK 1
 #define DISPLAY_WIDTH 400
 #define DISPLAY_HEIGHT 300
-
-Epd epd;
-Epd_GFX gfx (DISPLAY_WIDTH, DISPLAY_HEIGHT);
-boolean firstBoot;
+#define CLOCK_X 280                 // clock window in headline, byte aligned
+#define CLOCK_HEIGHT R1_Y
 
 /**
- * @brief Timeout function for user interaction. Will be called if no user interaction during specified time.
+ * @brief Clock window of the headline rendered for the next wakeup.
  * 
- * @param xTimer Not used.
  */
-void userTimeout(TimerHandle_t xTimer){
-  screenManager.triggerEvent(Event::USER_TIMEOUT);
-}
-TimerHandle_t inUseTimer = xTimerCreate("in use", 5000, pdFALSE,( void * ) 0, userTimeout);
-
-/**
- * @brief Timeout to enter deep sleep.
- * 
- * @param xTimer Not used.
- */
-void offTimeout(TimerHandle_t xTimer){
-  sleep();
-}
-TimerHandle_t offTimer = xTimerCreate("switch to sleep", 2000, pdFALSE,( void * ) 0, offTimeout);
+struct ClockFrame {
+  time_t time;                      // start of minute shown in image, 0 if invalid
+  uint16_t changedPixels;           // pixels changed compared to the previous clock
+  uint8_t image[(DISPLAY_WIDTH-CLOCK_X)/8*CLOCK_HEIGHT];
+};
 
-
-/**
- * @brief Timeout to start redraw of current screen.
- * 
- * @param xTimer Not used.
- */
-void redrawTimeout(TimerHandle_t xTimer){
-  screenManager.triggerEvent(Event::REDRAW);
-}
-TimerHandle_t redrawTimer = xTimerCreate("redraw", 500, pdFALSE,( void * ) 0, redrawTimeout);
+#ifdef BANDED_RENDERING
+#if BAND_ROWS < CLOCK_HEIGHT
+#error "BAND_ROWS must cover the clock window"
+#endif
+static uint8_t framebuffer[DISPLAY_WIDTH*BAND_ROWS/8];
+Epd_GFX gfx (DISPLAY_WIDTH, DISPLAY_HEIGHT, BAND_ROWS, framebuffer);
+#else
+static uint8_t framebuffer[DISPLAY_WIDTH*DISPLAY_HEIGHT/8];
+Epd_GFX gfx (DISPLAY_WIDTH, DISPLAY_HEIGHT, DISPLAY_HEIGHT, framebuffer);
+#endif
+boolean frameDirty = false;       // rows changed, but not sent to display
+uint16_t dirtyFirst;
+uint16_t dirtyLast;
+uint16_t shownFirst = 0;          // rows sent with last refresh
+uint16_t shownLast = R3_Y-1;
+boolean renderPending = false;    // banded rendering delayed until display is idle
+RTC_DATA_ATTR struct ClockFrame nextClock;
+portMUX_TYPE eventMux = portMUX_INITIALIZER_UNLOCKED;
+struct Snapshot shown;             // snapshot of received data for all bands of a frame
 
 /**
  * @brief Class representing behavior of entry screen.
@@ -119,17 +123,11 @@ class EntryScreen: public Screen {
         break;          
         case Event::CONNECTION_FINISHED:
           this->draw();
-          xTimerStart (offTimer, 10);
         break;
-        case Event::CONNECTION_FAILED:
-          xTimerStart (offTimer, 10);
-        break;      
       }
     }
 };
 
-EntryScreen entryScreen;
-
 
 /**
  * @brief Main screen, which shows the status information and time.
@@ -153,15 +151,6 @@ class MainScreen: public Screen {
       return "Main";
     }
     
-    /**
-     * @brief Deactivate main screen. Set timer to enter deep sleep after timeout.
-     * 
-     */
-    void deactivate(){
-      Screen::deactivate();
-      xTimerStop (offTimer, 0);
-    }
-    
     /**
      * @brief Event handler of main screen.
      * 
@@ -186,11 +175,7 @@ class MainScreen: public Screen {
         break;
         case Event::CONNECTION_FINISHED:
           this->draw();
-          xTimerStart (offTimer, 10);
         break;
-        case Event::CONNECTION_FAILED:
-          xTimerStart (offTimer, 10);
-        break;      
       }
     }
   
@@ -204,14 +189,61 @@ class MainScreen: public Screen {
       snprintf(buffer, 11, "%02d.%02d.%02d", day(), month(), year());
       gfx.setCursor(5, R1_Y-6);
       gfx.print(buffer);
-      snprintf(buffer, 6, "%02d:%02d", hour(), minute());
+      drawClock(now());
+    } 
+
+    /**
+     * @brief Draw time right aligned in headline. Font and color have to be set before.
+     * 
+     * @param time Time to be drawn.
+     */
+    void drawClock(time_t time){
+      char buffer[6];
+      snprintf(buffer, 6, "%02d:%02d", hour(time), minute(time));
       int16_t  x1, y1;
       uint16_t w, h;
       gfx.getTextBounds(buffer, 0, 0, &x1, &y1, &w, &h);
       gfx.setCursor(DISPLAY_WIDTH - 5 - w - x1, R1_Y-6);
       gfx.print(buffer);
-    } 
+    }
+
+    /**
+     * @brief Draw only the clock window of the headline for the given time.
+     * 
+     * @param time Time to be drawn.
+     */
+    void drawClockWindow(time_t time){
+      gfx.fillRect(CLOCK_X, 0, DISPLAY_WIDTH-CLOCK_X, CLOCK_HEIGHT, EPD_BLACK);
+      gfx.setTextColor(EPD_WHITE);
+      gfx.setTextSize(1);
+      gfx.setFont(&FreeSansBold18pt7b);
+      drawClock(time);
+    }
   
+    /**
+     * @brief Draw sign of transport type and line of a departure. The sign is sized to the label.
+     * 
+     * @param x Left column of sign.
+     * @param y Top row of sign.
+     * @param schedule Departure.
+     * @return int16_t Column right of the sign.
+     */
+    int16_t drawTransport(int16_t x, int16_t y, const struct Schedule& schedule){
+      const char* typeNames[] = {"Bus", "Tram", "U", "Taxi", "S", "Zug"};
+      char buffer[12];
+      snprintf(buffer, 12, "%s %d", schedule.type <= TRAIN ? typeNames[schedule.type] : "?", schedule.line);
+      int16_t  x1, y1;
+      uint16_t w, h;
+      gfx.getTextBounds(buffer, 0, 0, &x1, &y1, &w, &h);
+      int16_t width = max(88, x1 + w + 8);
+      gfx.fillRoundRect(x, y, width, 24, 4, EPD_BLACK);
+      gfx.setTextColor(EPD_WHITE);
+      gfx.setCursor(x + 4, y + 20);
+      gfx.print(buffer);
+      gfx.setTextColor(EPD_BLACK);
+      return x + width;
+    }
+
     /**
      * @brief Draw content area of main screen.
      * 
@@ -219,66 +251,90 @@ class MainScreen: public Screen {
     void drawMain(){
       Screen::drawMain();
       char buffer[21];
+      // temperature history of last 24 h
+      static int16_t history[HISTORY_SAMPLES];    // static to keep the event loop stack small
+      historySeries(&shown.history, HISTORY_TEMPERATURE, history);
+      gfx.drawSparkline(5, R2_Y-52, 185, 10, history, HISTORY_SAMPLES, 10);
+      historySeries(&shown.history, HISTORY_OUTDOOR_TEMPERATURE, history);
+      gfx.drawSparkline(200, R2_Y-52, 185, 10, history, HISTORY_SAMPLES, 10);
+
       // temperature and humidity
       gfx.setFont(&FreeSans18pt7b);
       gfx.drawBitmap (5, R2_Y-40, tempIn32, 32, 32, EPD_BLACK);  
       gfx.setCursor(40, R2_Y-12);
-      snprintf(buffer, 8, "%2.1f", getTemperature());
+      snprintf(buffer, 8, "%2.1f", shown.status.temperature);
       gfx.print(buffer);
       int16_t  x1, y1;
       uint16_t w, h;
       gfx.getTextBounds(buffer, 0, 0, &x1, &y1, &w, &h); 
       gfx.drawBitmap (x1 + w + 42, R2_Y-37, degree13, 18, 18, EPD_BLACK);  
-      snprintf(buffer, 8, "%2d%%", getHumidity());
+      snprintf(buffer, 8, "%2d%%", shown.status.humidity);
       gfx.setCursor(58 + w + x1, R2_Y-12);  
       gfx.print(buffer);
       gfx.drawBitmap (200, R2_Y-40, tempOut32, 32, 32, EPD_BLACK);
       gfx.setCursor(235, R2_Y-12);
-      snprintf(buffer, 8, "%2.1f", getOutdoorTemperature());
+      snprintf(buffer, 8, "%2.1f", shown.status.outdoorTemperature);
       gfx.print(buffer);
       gfx.getTextBounds(buffer, 0, 0, &x1, &y1, &w, &h); 
       gfx.drawBitmap (x1 + w + 237, R2_Y-38, degree13, 18, 18, EPD_BLACK);       
-      snprintf(buffer, 8, "%2d%%", getOutdoorHumidity());
+      snprintf(buffer, 8, "%2d%%", shown.status.outdoorHumidity);
       gfx.setCursor(263 + w + x1, R2_Y-12);  
       gfx.print(buffer);
       
-      // Bus timetable
-      gfx.drawBitmap (5, R1_Y+15, bus64, 64, 64, EPD_BLACK);
-      struct Schedule* busTimeTable = getBusTimeTable();
-      gfx.setFont(&FreeSans18pt7b);
-      gfx.setCursor(75, R1_Y+42);
-      snprintf(buffer, 20, "%02d:%02d - %02d:%02d  %d", busTimeTable[0].departure/60, busTimeTable[0].departure%60, 
-        busTimeTable[0].arrival/60, busTimeTable[0].arrival%60, busTimeTable[0].line);
-      gfx.print(buffer);      
-      gfx.setCursor(75, R1_Y+75);
-      snprintf(buffer, 20, "%02d:%02d - %02d:%02d  %d", busTimeTable[1].departure/60, busTimeTable[1].departure%60, 
-        busTimeTable[1].arrival/60, busTimeTable[1].arrival%60, busTimeTable[1].line);
-      gfx.print(buffer);        
-           
-      // window state
-      gfx.setFont(&FreeSans12pt7b);
-      boolean open = false;
-      int i = 0;
-      uint8_t* windows = getWindows();
+      // next departures from timetable of the day, from a synchronization of the same day otherwise
+      struct Schedule departures[TIMETABLE_NEXT];
+      uint8_t count = 0;
       gfx.setFont(&FreeSans12pt7b);
-      for (uint8_t room=(uint8_t)Room::LIVINGROOM; room<(uint8_t)Room::LAST; room++){
-        uint8_t window = windows[(int)room]&0x03;
-        if (window == 1 || window == 2){
-          open = true;
-          char* openRoom;
-          switch (room){
-            case (int)Room::DININGROOM: openRoom = "Esszimmer"; break;
-            case (int)Room::BEDROOM: openRoom = "Schlafz."; break;
-            case (int)Room::KITCHEN: openRoom = "Kueche"; break;
-            case (int)Room::BATHROOM_GF: openRoom = "Bad"; break;                                    
+      if (timetableValid(&shown.timetable, now())){
+        count = timetableNext(&shown.timetable, now(), departures, TIMETABLE_NEXT);
+      } else if (previousMidnight(shown.status.received[FIELD_BUS]) == previousMidnight(now())){
+        uint16_t minuteOfDay = elapsedSecsToday(now())/SECS_PER_MIN;
+        for (uint8_t i=0; i<shown.status.busCount; i++){
+          if (shown.status.busTimeTable[i].departure >= minuteOfDay){
+            departures[count++] = shown.status.busTimeTable[i];
           }
-          if (i<3){
-            gfx.setCursor(270, R1_Y+122+20*i);  
-            gfx.print(openRoom);
-            i++;
+        }
+      }
+      if (count == 0){
+        gfx.setCursor(5, R1_Y+36);
+        gfx.print("Keine Abfahrten mehr");
+      }
+      for (uint8_t i=0; i<count; i++){
+        int16_t x = drawTransport(5, R1_Y+16+28*i, departures[i]);
+        gfx.setCursor(max(100, x + 7), R1_Y+36+28*i);
+        snprintf(buffer, 20, "%02d:%02d - %02d:%02d", departures[i].departure/60, departures[i].departure%60, 
+          departures[i].arrival/60%24, departures[i].arrival%60);
+        gfx.print(buffer);
+      }
+           
+      // window state, open rooms ordered by floor
+      uint8_t openRooms[ROOMS_MAX];
+      uint8_t openCount = 0;
+      for (uint8_t room=0; room<shown.status.roomCount; room++){
+        enum WindowState window = windowState(&shown.status, room);
+        if (window == WindowState::OPEN || window == WindowState::TILTED){
+          uint8_t i = openCount++;
+          for (; i>0 && roomFloor(&shown.rooms, openRooms[i-1]) > roomFloor(&shown.rooms, room); i--){
+            openRooms[i] = openRooms[i-1];
           }
+          openRooms[i] = room;
         }
       }
+      boolean open = openCount > 0;
+      gfx.setFont(&FreeSans12pt7b);
+      // 3 rows, the last row counts the rooms not shown
+      uint8_t rows = openCount > 3 ? 2 : openCount;
+      for (uint8_t i=0; i<rows; i++){
+        char name[ROOM_NAME_LENGTH + 1];
+        roomName(&shown.rooms, openRooms[i], name, sizeof(name));
+        gfx.setCursor(270, R1_Y+122+20*i);  
+        gfx.print(name);
+      }
+      if (openCount > rows){
+        gfx.setCursor(270, R1_Y+122+20*rows);  
+        snprintf(buffer, 20, "+%d weitere", openCount - rows);
+        gfx.print(buffer);
+      }
       gfx.drawBitmap (200, 140, open?windowOpen64:windowClosed64, 64, 64, EPD_BLACK);
       gfx.setFont(&FreeSans18pt7b);
       if (!open){
@@ -289,12 +345,12 @@ class MainScreen: public Screen {
       // Garbage
       gfx.setFont(&FreeSans18pt7b);
       gfx.drawBitmap(10, 140, trash64, 46, 64, EPD_BLACK);
-      struct Garbage nextCollection = getNextGarbageCollection();
+      struct Garbage nextCollection = garbageNext(&shown.garbage, now(), &shown.status);
       if (nextCollection.days != 255){
         gfx.setCursor(70, 165);
         char* typeNames[] = {"Braun", "Grau", "Blau", "Gelb", "---"};
         gfx.print(typeNames[nextCollection.type]);
-        gfx.setCursor(70, 202);
+        gfx.setCursor(70, 198);     // descenders end above the temperature history
         uint8_t days = nextCollection.days;
         snprintf(buffer, 15, "%d ", days);
         gfx.print(buffer);
@@ -303,8 +359,6 @@ class MainScreen: public Screen {
     }
 };
 
-MainScreen mainScreen;
-
 /**
  * @brief  Audio screen, which switches amplifier on or off.
  * 
@@ -345,6 +399,8 @@ class AudioScreen: public Screen {
       gfx.setCursor(17, R1_Y+85);    
       if (_communicating){
         gfx.print(audioModeWritten()?"OK":"Sende Daten");
+      } else if (_dataSent){
+        gfx.print("OK");
       }
     }   
       
@@ -357,18 +413,22 @@ class AudioScreen: public Screen {
       Screen::triggerEvent(event);
       switch (event) {
         case Event::OFF: 
+          _dataSent = false;
           writeAudioMode(false);
           _communicating = true;
           draw();
         break;
         case Event::ON:
+          _dataSent = false;
           writeAudioMode(true);
           _communicating = true;
           draw();
         break;
         case Event::DATA_SENT:
-          draw();          
-          _communicating = false;       
+          // drawing is deferred, the confirmation is kept until the next command
+          _communicating = false;
+          _dataSent = true;
+          draw();
         break;
       }
     }
@@ -377,8 +437,6 @@ class AudioScreen: public Screen {
     boolean _dataSent = false;    
 };
 
-AudioScreen audioScreen;
-
 /**
  * @brief Heating screen, which is used to enter the end of the party mode.
  * 
@@ -467,8 +525,6 @@ class HeatingScreen: public Screen {
     boolean _communicating = false;
 };
 
-HeatingScreen heatingScreen;
-
 /**
  * @brief Heating screen, which is used to change between absent and home mode.
  * 
@@ -509,6 +565,8 @@ class AbsentScreen: public Screen {
       gfx.setCursor(17, R1_Y+85);    
       if (_communicating){
         gfx.print(homeModeWritten()?"OK":"Sende Daten");
+      } else if (_dataSent){
+        gfx.print("OK");
       }
     }   
     
@@ -521,19 +579,22 @@ class AbsentScreen: public Screen {
       Screen::triggerEvent(event);
       switch (event) {
         case Event::ABSENT: 
+          _dataSent = false;
           writeHomeMode(false);
           _communicating = true;
           draw();
         break;
         case Event::HOME:
+          _dataSent = false;
           writeHomeMode(true);
           _communicating = true;
           draw();
         break;
         case Event::DATA_SENT:
-          draw();          
+          // drawing is deferred, the confirmation is kept until the next command
           _communicating = false;
-          
+          _dataSent = true;
+          draw();
         break;
       }
     }
@@ -542,8 +603,6 @@ class AbsentScreen: public Screen {
     boolean _dataSent = false;
 };
 
-AbsentScreen absentScreen;
-
 
 /**
  * @brief Screen class implements common behavior regarding activation, event handling, headline, and softkey handling. 
@@ -587,16 +646,25 @@ void Screen::triggerEvent(Event event){
     Event newEvent = _softkeys[(int)event].event;
     screenManager.triggerEvent(newEvent);
   }else if (event == Event::REDRAW){
+    _drawCounter++;
+    screenToDisplay();
+  }else if (event == Event::DISPLAY_READY){
+#ifdef BANDED_RENDERING
+    if (renderPending){
+      draw();
+      return;
+    }
+#endif
     screenToDisplay();
   }
 }
 
 /**
- * @brief Activate screen. Draw screen 2 times due to behavior of e-inc display.
+ * @brief Activate screen. The refresh policy repeats the refresh for large changes due to behavior of e-inc display.
  * 
  */
 void Screen::activate(){
-  draw(2);
+  draw();
 }
 
 /**
@@ -604,24 +672,98 @@ void Screen::activate(){
  * 
  */
 void Screen::deactivate(){
+  _drawPending = false;
 }
 
 /**
- * @brief Draw screen.
+ * @brief Draw screen. Inside of the event loop, drawing is deferred until all pending events are handled.
  * 
  */
 void Screen::draw(){
+  if (screenManager.dispatching()){
+    _drawPending = true;   // drawn by drawPending()
+    return;
+  }
+#ifdef BANDED_RENDERING
+  // display memory is written while rendering, render latest state after Event::DISPLAY_READY
+  renderPending = displayBusy();
+  if (renderPending){
+    return;
+  }
+#endif
   Serial.println("Draw Screen");
+  getSnapshot(&shown);
+  frameBegin(gfx.width()/8, R3_Y);
+#ifdef BANDED_RENDERING
+  // band by band to display memory, refresh follows in screenToDisplay()
+  for (int16_t y=0; y<R3_Y; y+=gfx.getBandRows()){
+    int16_t rows = min(gfx.getBandRows(), (int16_t)(R3_Y-y));
+    gfx.setBand(y);
+    this->drawHeadline();
+    drawMain();
+    drawSoftkeys();
+    frameRows(gfx.getImage(), rows);
+    displayWrite(gfx.getImage(), y, gfx.width(), rows);
+  }
+#else
   this->drawHeadline();
   drawMain();
   drawSoftkeys();
+  frameRows(gfx.getImage(), R3_Y);
+#endif
+  // The clock window shown by ScreenManager::showPrerendered() is not part of the stored frame, 
+  // but a new clock differs from the stored one as well.
+  uint16_t first, last;
+  if (frameEnd(&first, &last)){
+    refreshChanged(first, last);
+    markDirty(first, last);
+  } else {
+    _drawCounter = 0;   // frame is already shown
+  }
   screenToDisplay();
 }
 
 /**
- * @brief Draw screen multiple times to improve quality on e-inc display.
+ * @brief Draw screen, if drawing was deferred while events were handled. All changes are committed in a single frame.
  * 
- * @param number
+ */
+void Screen::drawPending(){
+  if (_drawPending){
+    _drawPending = false;
+    draw();
+  }
+}
+
+/**
+ * @brief Check if frames or refreshes are pending.
+ * 
+ * @return true Draw, frame or additional refresh pending.
+ */
+bool Screen::pending(){
+  return _drawPending || _drawCounter > 0 || frameDirty || renderPending;
+}
+
+/**
+ * @brief Mark rows to be sent to the display with the next refresh.
+ * 
+ * @param first First row.
+ * @param last Last row.
+ */
+void Screen::markDirty(uint16_t first, uint16_t last){
+  if (frameDirty){
+    first = min(first, dirtyFirst);
+    last = max(last, dirtyLast);
+  }
+  dirtyFirst = first;
+  dirtyLast = last;
+  frameDirty = true;
+}
+
+/**
+ * @brief Draw screen and refresh it multiple times to improve quality on e-inc display. 
+ *  The refreshes follow each other after Event::DISPLAY_READY.
+ * 
+ * @param number Number of additional refreshes.
  */
 void Screen::draw(uint8_t number){
   _drawCounter = number;
@@ -675,23 +817,39 @@ void Screen::drawSoftkey(uint8_t index, const unsigned char* bmp){
 }
 
 /**
- * @brief Send framebuffer to display device. Handle redraw if required.
+ * @brief Send changed rows of framebuffer to display device, if display is not busy. 
+ *  The display memory holds the shown frame, while the next frame is rendered into the framebuffer. 
+ *  Frames rendered during a refresh are merged, only the latest is sent. 
+ *  Without new frame, the shown rows are refreshed again as long as redraws are requested.
+ *  The refresh policy selects quick, double or full refresh against ghosting.
  * 
  */
 void Screen::screenToDisplay(){
-  Serial.println("Screen to display");
-  epd.WaitUntilIdle();
-  if (firstBoot){
-    epd.SetPartialWindow(gfx.getImage(), 0, 0, gfx.width(), R3_Y, 1);
-    firstBoot = false;
-  }
-  epd.SetPartialWindow(gfx.getImage(), 0, 0, gfx.width(), R3_Y, 2);
-  epd.DisplayFrameQuick();
-  if (_drawCounter > 0){
+  if (displayBusy()){
+    return; // continued after Event::DISPLAY_READY
+  }
+  if (frameDirty){
+    Serial.println("Screen to display");
+    uint16_t first = dirtyFirst;
+    uint16_t last = dirtyLast;
+    Refresh refresh = refreshPlan(&first, &last);   // full refresh extends rows to whole regions
+    uint16_t rows = last - first + 1;
+#ifndef BANDED_RENDERING
+    displayWrite(gfx.getImage() + first*gfx.width()/8, first, gfx.width(), rows);
+#endif
+    // display memory is written by draw() in case of banded rendering
+    displayRefresh(first, rows, refreshWaveform(refresh, first, last));
+    if (refresh == Refresh::DOUBLE && _drawCounter == 0){
+      _drawCounter = 1;
+    }
+    shownFirst = first;
+    shownLast = last;
+    frameDirty = false;
+  } else if (_drawCounter > 0){
+    Serial.println("Redraw");
     _drawCounter--;
-    uint16_t delay = _drawCounter?800:200;
-    xTimerStart (redrawTimer, delay);
-  }  
+    displayRefresh(shownFirst, shownLast - shownFirst + 1, refreshWaveform(Refresh::QUICK, shownFirst, shownLast));
+  }
 }
 
 
@@ -704,62 +862,261 @@ void startExecute(void* param){
   screenManager.execute();
 }
 
+#define EVENT_LOOP_STACK_SIZE 2048
+#define USER_TIMEOUT_TICKS 5000   // user idle time until the main screen is shown again
+#define EVENT_QUEUE_LENGTH 8
+static StackType_t eventLoopStack[EVENT_LOOP_STACK_SIZE];
+static StaticTask_t eventLoopTask;
+static uint8_t eventQueueStorage[EVENT_QUEUE_LENGTH*sizeof(Event)];
+static StaticQueue_t eventQueue;
+
 ScreenManager::ScreenManager(){
-  _eventQueue = xQueueCreate(4, sizeof(Event));
-  xTaskCreate(&startExecute, "eventloop", 2048, NULL, 2, NULL);
 }
 
 /**
- * @brief Enter event in event queue.
+ * @brief Check if an event is coalesced. Coalesced events are kept as pending flags instead of queue entries, 
+ *  so repeated events are handled once. Data and display events are coalesced, user and action events are queued in order.
+ * 
+ * @param event 
+ * @return true Event is coalesced.
+ */
+static bool IRAM_ATTR isCoalesced(Event event){
+  switch (event){
+    case Event::REDRAW:
+    case Event::CONNECTION_FINISHED:
+    case Event::CONNECTION_FAILED:
+    case Event::DATA_SENT:
+    case Event::TIME_UPDATE:
+    case Event::TEMPERATURE:
+    case Event::HUMIDITY:
+    case Event::WINDOW:
+    case Event::DISPLAY_READY:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/**
+ * @brief Create event queue and start event loop task. Not required if only a single screen is drawn by show().
+ * 
+ */
+void ScreenManager::begin(){
+  if (_eventQueue == nullptr){
+    _eventQueue = xQueueCreateStatic(EVENT_QUEUE_LENGTH, sizeof(Event), eventQueueStorage, &eventQueue);
+    _task = xTaskCreateStatic(&startExecute, "eventloop", EVENT_LOOP_STACK_SIZE, NULL, 2, eventLoopStack, &eventLoopTask);
+  }
+}
+
+/**
+ * @brief Enter event in event queue or mark coalesced event as pending. Does not block, 
+ *  events are dropped if the queue is full. Events are ignored as long as the event loop is not started.
  * 
  * @param event 
  */
 void ScreenManager::triggerEvent (Event event){
-  xQueueSend(_eventQueue, &event, 200);
+  if (_eventQueue == nullptr){
+    return;
+  }
+  if (isCoalesced(event)){
+    portENTER_CRITICAL(&eventMux);
+    _coalescedEvents |= 1 << (int)event;
+    portEXIT_CRITICAL(&eventMux);
+  } else if (xQueueSend(_eventQueue, &event, 0) != pdTRUE){
+    Serial.println("Event queue full");
+    return;
+  }
+  xTaskNotifyGive(_task);
+}
+
+/**
+ * @brief Enter event in event queue from interrupt handler.
+ * 
+ * @param event 
+ * @param woken Set to pdTRUE if a higher priority task was woken.
+ */
+void IRAM_ATTR ScreenManager::triggerEventFromISR (Event event, BaseType_t* woken){
+  if (_eventQueue == nullptr){
+    return;
+  }
+  if (isCoalesced(event)){
+    portENTER_CRITICAL_ISR(&eventMux);
+    _coalescedEvents |= 1 << (int)event;
+    portEXIT_CRITICAL_ISR(&eventMux);
+  } else if (xQueueSendFromISR(_eventQueue, &event, woken) != pdTRUE){
+    return;
+  }
+  vTaskNotifyGiveFromISR(_task, woken);
+}
+
+/**
+ * @brief Check if the event loop is handling events.
+ * 
+ * @return true Events are handled, drawing is deferred.
+ */
+bool ScreenManager::dispatching(){
+  return _dispatching && xTaskGetCurrentTaskHandle() == _task;
+}
+
+/**
+ * @brief Get screen for a screen request event. Screens are constructed on first request.
+ * 
+ * @param event Screen request event.
+ * @return Screen* Requested screen or nullptr if event is no screen request.
+ */
+Screen* ScreenManager::getScreen (Event event){
+  switch (event) {
+    case Event::SCREEN_ENTRY: {
+      static EntryScreen entryScreen;
+      return &entryScreen;
+    }
+    case Event::SCREEN_MAIN: {
+      static MainScreen mainScreen;
+      return &mainScreen;
+    }
+    case Event::SCREEN_AUDIO: {
+      static AudioScreen audioScreen;
+      return &audioScreen;
+    }
+    case Event::SCREEN_HEATING: {
+      static HeatingScreen heatingScreen;
+      return &heatingScreen;
+    }
+    case Event::SCREEN_ABSENT: {
+      static AbsentScreen absentScreen;
+      return &absentScreen;
+    }
+    default:
+      return nullptr;
+  }
+}
+
+/**
+ * @brief Draw a screen once in the context of the caller. Used after timer wakeup without event loop and timers.
+ * 
+ * @param event Screen request event.
+ */
+void ScreenManager::show (Event event){
+  Screen *screen = getScreen(event);
+  if (screen != nullptr){
+    _activeScreen = screen;
+    screen->draw();
+  }
 }
     
 /**
- * @brief Event loop and event handler for screen request events.
+ * @brief Render the clock window of the main screen for the next wakeup and keep it in RTC memory. 
+ *  The clock window is only rendered if the main screen is shown and only the clock changes.
+ * 
+ * @param time Start of minute of the next wakeup.
+ */
+void ScreenManager::prerender (time_t time){
+  MainScreen* mainScreen = (MainScreen*)getScreen(Event::SCREEN_MAIN);
+  // main area has to be drawn, if the date or the next departures change. Nothing is drawn after a wakeup
+  // with prerendered clock, so the snapshot is taken here.
+  getSnapshot(&shown);
+  if (_activeScreen == mainScreen && day(time) == day() && year() >= 2016 && !timetableChanged(&shown.timetable, now(), time)){
+    static uint8_t image[sizeof(nextClock.image)];
+    gfx.setBand(0);
+    mainScreen->drawClockWindow(time);
+    gfx.getWindow(image, CLOCK_X, 0, DISPLAY_WIDTH-CLOCK_X, CLOCK_HEIGHT);
+    // the previous clock image is an estimation of the shown clock for the refresh policy
+    nextClock.changedPixels = 0;
+    for (uint16_t i=0; i<sizeof(image); i++){
+      nextClock.changedPixels += nextClock.time ? __builtin_popcount(nextClock.image[i] ^ image[i]) : 8;
+      nextClock.image[i] = image[i];
+    }
+    nextClock.time = time;
+  } else {
+    nextClock.time = 0;
+  }
+}
+
+/**
+ * @brief Send clock window rendered before deep sleep to the display, if it is valid for the current minute.
+ * 
+ * @return true Clock window shown, main screen is up to date.
+ * @return false No valid clock window or full refresh due, screen has to be drawn.
+ */
+bool ScreenManager::showPrerendered (){
+  if (nextClock.time == 0 || nextClock.time != now() - now()%60 || !refreshWindow(0, nextClock.changedPixels)){
+    return false;
+  }
+  displayInit(false);
+  displayWindow(nextClock.image, CLOCK_X, 0, DISPLAY_WIDTH-CLOCK_X, CLOCK_HEIGHT, Waveform::FAST);
+  _activeScreen = getScreen(Event::SCREEN_MAIN);
+  return true;
+}
+
+/**
+ * @brief Event loop. Queued user events are handled before coalesced data events. 
+ *  The active screen is drawn once after all pending events are handled. 
+ *  Event::USER_TIMEOUT is generated if no key is pressed for USER_TIMEOUT_TICKS.
  * 
  */
 void ScreenManager::execute () {
   while (true){
+    TickType_t wait = portMAX_DELAY;
+    if (_inUse){
+      TickType_t elapsed = xTaskGetTickCount() - _lastKey;
+      wait = elapsed < USER_TIMEOUT_TICKS ? USER_TIMEOUT_TICKS - elapsed : 0;
+    }
+    ulTaskNotifyTake(pdTRUE, wait);
+    _dispatching = true;
+    if (_inUse && xTaskGetTickCount() - _lastKey >= USER_TIMEOUT_TICKS){
+      _inUse = false;
+      dispatch(Event::USER_TIMEOUT);
+    }
     Event event; // out of Freertos queue
-    if( xQueueReceive(_eventQueue, &event, (TickType_t) 100)){;
-      switch (event) {
-        case Event::SCREEN_ENTRY:
-          requestScreen(&entryScreen);
-        break;        
-        case Event::SCREEN_MAIN:
-          requestScreen(&mainScreen);
-        break;
-        case Event::SCREEN_AUDIO:
-          requestScreen(&audioScreen);
-        break;        
-        case Event::SCREEN_HEATING:
-          requestScreen(&heatingScreen);
-        break;
-        case Event::SCREEN_ABSENT:
-          requestScreen(&absentScreen);
-        break;
-        case Event::BACK:
-          requestScreen(&mainScreen);
-          xTimerStart (offTimer, 2000);
-        break;
-        case Event::USER_TIMEOUT:
-          requestScreen(&mainScreen);
-          xTimerStart (offTimer, 2000);
-        break;             
-        default: 
-          if (_activeScreen != nullptr){
-            _activeScreen->triggerEvent(event);        
-          }
+    while (xQueueReceive(_eventQueue, &event, 0)){
+      dispatch(event);
+    }
+    portENTER_CRITICAL(&eventMux);
+    uint32_t coalesced = _coalescedEvents;
+    _coalescedEvents = 0;
+    portEXIT_CRITICAL(&eventMux);
+    for (int i=0; coalesced != 0; i++){
+      if (coalesced & 1 << i){
+        coalesced &= ~(1 << i);
+        dispatch((Event)i);
       }
-      // Handle user idle timeout on root level. Switch back to entry screen
-      if (event >= Event::KEY_0 && event <= Event::KEY_3){
-        xTimerStart(inUseTimer, 5000);
+    }
+    _dispatching = false;
+    if (_activeScreen != nullptr){
+      _activeScreen->drawPending();
+    }
+    telemetryStack(TASK_EVENTLOOP);
+    powerNotify();
+  }
+}
+
+/**
+ * @brief Event handler for screen request events. Other events are passed to the active screen.
+ * 
+ * @param event 
+ */
+void ScreenManager::dispatch (Event event) {
+  switch (event) {
+    case Event::SCREEN_ENTRY:
+    case Event::SCREEN_MAIN:
+    case Event::SCREEN_AUDIO:
+    case Event::SCREEN_HEATING:
+    case Event::SCREEN_ABSENT:
+      requestScreen(getScreen(event));
+    break;
+    case Event::BACK:
+    case Event::USER_TIMEOUT:
+      requestScreen(getScreen(Event::SCREEN_MAIN));
+    break;             
+    default: 
+      if (_activeScreen != nullptr){
+        _activeScreen->triggerEvent(event);        
       }
-    }  
+  }
+  // Handle user idle timeout on root level. Switch back to entry screen
+  if (event >= Event::KEY_0 && event <= Event::KEY_3){
+    _inUse = true;
+    _lastKey = xTaskGetTickCount();
   }
 }
 
@@ -775,30 +1132,54 @@ void ScreenManager::requestScreen (Screen *screen){
     _activeScreen->deactivate();
   }
   _activeScreen = screen;
+  // the user works with sub screens, the device may sleep while the main screen is shown
+  if (screen == getScreen(Event::SCREEN_MAIN) || screen == getScreen(Event::SCREEN_ENTRY)){
+    powerRelease(WORK_USER);
+  } else {
+    powerAcquire(WORK_USER);
+  }
   screen->activate();
 }
 
+/**
+ * @brief Check if all events are handled and all frames of the active screen are sent to the display.
+ * 
+ * @return true Nothing outstanding, a running refresh is finished by displayOff().
+ */
+bool ScreenManager::idle(){
+  return uxQueueMessagesWaiting(_eventQueue) == 0 && _coalescedEvents == 0 && !_dispatching && 
+    (_activeScreen == nullptr || !_activeScreen->pending());
+}
+
 ScreenManager screenManager;
 
 
 /**
- * @brief Edp graphics based on Adafruit GFX.
+ * @brief Edp graphics based on Adafruit GFX. The framebuffer holds a band of rows, 
+ *  which is moved over the display to render a screen band by band.
  * 
  * @param w Display width.
  * @param h Display height.
+ * @param bandRows Rows of framebuffer, display height for a full framebuffer.
+ * @param framebuffer Statically allocated framebuffer of w*bandRows/8 bytes.
  */
-Epd_GFX::Epd_GFX (int16_t w, int16_t h) : Adafruit_GFX(w, h) {
-  _framebuffer = (uint8_t *)malloc (w*h/8);
+Epd_GFX::Epd_GFX (int16_t w, int16_t h, int16_t bandRows, uint8_t* framebuffer) : Adafruit_GFX(w, h) {
+  _bandRows = bandRows;
+  _framebuffer = framebuffer;
 }
 
 /**
- * @brief Draw pixel method as interface between Adafruit GFX and EDP display driver.
+ * @brief Draw pixel method as interface between Adafruit GFX and EDP display driver. Pixels outside of the current band are ignored.
  * 
  * @param x 
  * @param y 
  * @param color 
  */
 void Epd_GFX::drawPixel(int16_t x, int16_t y, uint16_t color){
+  if (y < _bandY || y >= _bandY + _bandRows){
+    return;
+  }
+  y -= _bandY;
   uint16_t byteIndex = (y*width() + x)/8;
   uint8_t bitOffset = (y*width() + x)%8;
   uint8_t pixels = _framebuffer[byteIndex];
@@ -820,41 +1201,96 @@ uint8_t * Epd_GFX::getImage(){
 }
 
 /**
- * @brief Clear display.
+ * @brief Move band of framebuffer.
  * 
- * @param y1 Start row.
- * @param y2 End row.
- * @param color Color to be set.
+ * @param y First row of band.
  */
-void Epd_GFX::clear(uint16_t y1, uint16_t y2, uint16_t color){
-  for (int i=width()*y1/8; i<width()*(y2+1)/8; i++){
-    _framebuffer[i] = color==EPD_WHITE?0xff:0x00;
-  }
+void Epd_GFX::setBand(int16_t y){
+  _bandY = y;
 }
 
 /**
- * @brief Init display. Clear display after first boot, not after wakeup from deep sleep. 
+ * @brief Get number of rows of the band.
  * 
- * @param first True if first boot. False if wakeup from deep sleep.
+ * @return int16_t 
  */
-void displayInit (boolean first){
-  Serial.println("e-Paper init");
-  firstBoot = first;
-  if (epd.Init() != 0) {
-    Serial.println("e-Paper init failed");
-    return;
+int16_t Epd_GFX::getBandRows(){
+  return _bandRows;
+}
+
+/**
+ * @brief Copy a window of the framebuffer. The window has to be inside of the current band.
+ * 
+ * @param window Destination of window image.
+ * @param x Left column of window, multiple of 8.
+ * @param y Top row of window.
+ * @param w Width of window, multiple of 8.
+ * @param h Height of window.
+ */
+void Epd_GFX::getWindow(uint8_t* window, int16_t x, int16_t y, int16_t w, int16_t h){
+  for (int row=0; row<h; row++){
+    memcpy(window + row*w/8, _framebuffer + ((y-_bandY+row)*width() + x)/8, w/8);
   }
-  if (first) {
-    epd.ClearFrame();
-    epd.DisplayFrame(); 
-  } 
 }
 
 /**
- * @brief Switch display off to minimize current consumption.
+ * @brief Clear display rows inside of the current band.
  * 
+ * @param y1 Start row.
+ * @param y2 End row.
+ * @param color Color to be set.
  */
-void displayOff (){
-  epd.Sleep();
+void Epd_GFX::clear(uint16_t y1, uint16_t y2, uint16_t color){
+  int16_t first = max((int16_t)y1, _bandY) - _bandY;
+  int16_t last = min((int16_t)y2, (int16_t)(_bandY + _bandRows - 1)) - _bandY;
+  for (int i=width()*first/8; i<width()*(last+1)/8; i++){
+    _framebuffer[i] = color==EPD_WHITE?0xff:0x00;
+  }
 }
 
+/**
+ * @brief Draw values as line chart scaled to the window. Missing values of INT16_MIN interrupt the line.
+ * 
+ * @param x Left column of chart.
+ * @param y Top row of chart.
+ * @param w Width of chart.
+ * @param h Height of chart.
+ * @param values 
+ * @param count Number of values.
+ * @param minRange Min difference of values mapped to the height, avoids amplified noise.
+ */
+void Epd_GFX::drawSparkline(int16_t x, int16_t y, int16_t w, int16_t h, const int16_t* values, uint16_t count, int16_t minRange){
+  if (y > _bandY + _bandRows || y + h < _bandY || count < 2){
+    return;   // outside of band
+  }
+  int16_t low = INT16_MAX;
+  int16_t high = INT16_MIN;
+  for (uint16_t i=0; i<count; i++){
+    if (values[i] != INT16_MIN){
+      low = min(low, values[i]);
+      high = max(high, values[i]);
+    }
+  }
+  if (low > high){
+    return;   // no values
+  }
+  int32_t range = max(high - low, (int)minRange);
+  low -= (range - (high - low))/2;
+  int16_t lastX = 0;
+  int16_t lastY = INT16_MIN;
+  for (uint16_t i=0; i<count; i++){
+    if (values[i] == INT16_MIN){
+      lastY = INT16_MIN;
+      continue;
+    }
+    int16_t px = x + (int32_t)i*(w - 1)/(count - 1);
+    int16_t py = y + h - 1 - (int32_t)(values[i] - low)*(h - 1)/range;
+    if (lastY == INT16_MIN){
+      drawPixel(px, py, EPD_BLACK);
+    } else {
+      drawLine(lastX, lastY, px, py, EPD_BLACK);
+    }
+    lastX = px;
+    lastY = py;
+  }
+}
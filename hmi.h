@@ -10,24 +10,32 @@
 #define _HMI_H_
 
 #include <FreeRTOS.h>
+#include <freertos/task.h>
 #include <Adafruit_GFX.h>
+#include <TimeLib.h>
 
 #define R1_Y 38
 #define R2_Y 260
 #define R3_Y 299
 
 enum class Event {KEY_0, KEY_1, KEY_2, KEY_3, REDRAW, CONNECTION_FINISHED, CONNECTION_FAILED, DATA_SENT, USER_TIMEOUT, TIME_UPDATE, TEMPERATURE, 
-    HUMIDITY, WINDOW, OFF, ON, PLUS, MINUS, CONFIRM, ABSENT, HOME, BACK, SCREEN_ENTRY, SCREEN_MAIN, SCREEN_LIGHT, SCREEN_AUDIO, SCREEN_HEATING, SCREEN_ABSENT};
+    HUMIDITY, WINDOW, DISPLAY_READY, OFF, ON, PLUS, MINUS, CONFIRM, ABSENT, HOME, BACK, SCREEN_ENTRY, SCREEN_MAIN, SCREEN_LIGHT, SCREEN_AUDIO, SCREEN_HEATING, SCREEN_ABSENT};
 
 class Epd_GFX:public Adafruit_GFX {
   public:  
-  Epd_GFX (int16_t w, int16_t h);
+  Epd_GFX (int16_t w, int16_t h, int16_t bandRows, uint8_t* framebuffer);
   void drawPixel(int16_t x, int16_t y, uint16_t color);
   uint8_t * getImage();
+  void setBand(int16_t y);
+  int16_t getBandRows();
+  void getWindow(uint8_t* window, int16_t x, int16_t y, int16_t w, int16_t h);
   void clear(uint16_t y1, uint16_t y2, uint16_t color);
+  void drawSparkline(int16_t x, int16_t y, int16_t w, int16_t h, const int16_t* values, uint16_t count, int16_t minRange);
 
   private:
   uint8_t *_framebuffer;
+  int16_t _bandY = 0;
+  int16_t _bandRows;
 };
 
 struct Softkey {
@@ -36,9 +44,6 @@ struct Softkey {
   Event event;
 };
 
-void displayInit (bool first);
-void displayOff(void);
-
 
 class Screen {    
   public:
@@ -46,6 +51,8 @@ class Screen {
     void enter();    
     void draw();
     void draw(uint8_t number);
+    void drawPending();
+    bool pending();
     void addSoftkey (uint8_t index, Event event, const unsigned char* icon);
     virtual void triggerEvent(Event event);
     virtual void activate();
@@ -56,23 +63,39 @@ class Screen {
     virtual void drawMain();
     virtual void drawSoftkeys();
   private:
+    void markDirty(uint16_t first, uint16_t last);
     void screenToDisplay();
     void drawSoftkey(uint8_t index, const unsigned char* bmp);
     struct Softkey _softkeys[4];
     uint8_t _drawCounter = 0;
+    bool _drawPending = false;
 };
 
 class ScreenManager {
   public:
     ScreenManager();
+    void begin();
     void triggerEvent(Event event);
+    void triggerEventFromISR(Event event, BaseType_t* woken);
     void requestScreen (Screen *screen);
+    void show(Event event);
+    void prerender(time_t time);
+    bool showPrerendered();
+    bool dispatching();
+    bool idle();
     void execute();
   private:
+    Screen* getScreen(Event event);
+    void dispatch(Event event);
     Screen *_activeScreen = nullptr;
-    QueueHandle_t _eventQueue; 
+    QueueHandle_t _eventQueue = nullptr; 
+    TaskHandle_t _task = nullptr;
+    volatile uint32_t _coalescedEvents = 0;   // bit per pending event, see isCoalesced()
+    bool _dispatching = false;
+    bool _inUse = false;                      // user idle timeout running
+    TickType_t _lastKey = 0;
 };
 
 extern ScreenManager screenManager;
 
-#endif
+#endif
@@ -2,5 +2,7 @@
 #define _MAIN_H_
 
 void sleep (void);
+void deepSleep (uint8_t skipWakes);
+uint8_t getSkippableWakes (void);
 
-#endif
+#endif
@@ -0,0 +1,99 @@
+/**
+ * @file power.cpp
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Power state machine, which decides when to enter deep sleep.
+ *
+ * BOOT -> SYNCING -> INTERACTIVE -> DRAINING -> SLEEP
+ * - SYNCING while BLE communication is outstanding
+ * - INTERACTIVE while the user works with a sub screen
+ * - DRAINING until events are handled and frames are sent to the display
+ * - SLEEP as soon as nothing is outstanding, or if nothing happened for AWAKE_TIMEOUT
+ * The transitions are calculated by powerNext() in powerstate.cpp without side effects.
+ */
+
+#include <Arduino.h>
+#include "configuration.h"
+#include "power.h"
+#include "telemetry.h"
+
+static_assert((int)PowerState::SLEEP < TELEMETRY_PHASES, "telemetry has to cover all power states");
+
+static PowerState state = PowerState::BOOT;
+static volatile uint8_t outstanding = 0;
+static uint32_t lastActivity;
+static TaskHandle_t powerTask = nullptr;
+portMUX_TYPE powerMux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Start power state machine. Has to be called by the task which calls powerUpdate().
+ * 
+ */
+void powerBegin(){
+  powerTask = xTaskGetCurrentTaskHandle();
+  lastActivity = millis();
+}
+
+/**
+ * @brief Register outstanding work.
+ * 
+ * @param work WORK_... flags.
+ */
+void powerAcquire(uint8_t work){
+  portENTER_CRITICAL(&powerMux);
+  outstanding |= work;
+  portEXIT_CRITICAL(&powerMux);
+  powerNotify();
+}
+
+/**
+ * @brief Register finished work. Releasing work which is not outstanding has no effect.
+ * 
+ * @param work WORK_... flags.
+ */
+void powerRelease(uint8_t work){
+  portENTER_CRITICAL(&powerMux);
+  outstanding &= ~work;
+  portEXIT_CRITICAL(&powerMux);
+  powerNotify();
+}
+
+/**
+ * @brief Notify activity, e.g. handled events. Wakes the task of the state machine to check the state.
+ * 
+ */
+void powerNotify(){
+  lastActivity = millis();
+  if (powerTask != nullptr){
+    xTaskNotifyGive(powerTask);
+  }
+}
+
+/**
+ * @brief Get ticks until the device sleeps without activity.
+ * 
+ * @return TickType_t 
+ */
+TickType_t powerTimeout(){
+  uint32_t awake = millis() - lastActivity;
+  return pdMS_TO_TICKS(awake < AWAKE_TIMEOUT ? AWAKE_TIMEOUT - awake : 0) + 1;
+}
+
+/**
+ * @brief Update power state.
+ * 
+ * @param idle True if no events are pending and all frames are sent to the display.
+ * @return PowerState New state. The caller has to enter deep sleep for PowerState::SLEEP.
+ */
+PowerState powerUpdate(bool idle){
+  PowerState next = powerNext(state, outstanding, idle, millis() - lastActivity);
+  if (next != state){
+    Serial.print("Power state ");
+    Serial.print((int)state);
+    Serial.print(" -> ");
+    Serial.println((int)next);
+    state = next;
+  }
+  telemetryHeap((uint8_t)state);
+  return state;
+}
@@ -0,0 +1,22 @@
+/**
+ * @file power.h
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Power state machine, which decides when to enter deep sleep.
+ *
+ */
+
+#ifndef _POWER_H_
+#define _POWER_H_
+
+#include <Arduino.h>
+#include "powerstate.h"
+
+void powerBegin();
+void powerAcquire(uint8_t work);
+void powerRelease(uint8_t work);
+void powerNotify();
+TickType_t powerTimeout();
+PowerState powerUpdate(bool idle);
+
+#endif
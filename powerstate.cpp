@@ -0,0 +1,32 @@
+/**
+ * @file powerstate.cpp
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Transitions of the power state machine, free of platform dependencies to be tested on the host.
+ *
+ */
+
+#include "powerstate.h"
+#include "configuration.h"
+
+/**
+ * @brief Calculate next power state.
+ * 
+ * @param state Current state.
+ * @param work Outstanding work.
+ * @param idle True if no events are pending and all frames are sent to the display.
+ * @param awake ms since last activity, the device sleeps after AWAKE_TIMEOUT.
+ * @return PowerState 
+ */
+PowerState powerNext(PowerState state, uint8_t work, bool idle, uint32_t awake){
+  if (state == PowerState::SLEEP || awake >= AWAKE_TIMEOUT){
+    return PowerState::SLEEP;
+  }
+  if (work & WORK_USER){
+    return PowerState::INTERACTIVE;
+  }
+  if (work & WORK_BLE){
+    return state == PowerState::INTERACTIVE ? PowerState::INTERACTIVE : PowerState::SYNCING;
+  }
+  return idle ? PowerState::SLEEP : PowerState::DRAINING;
+}
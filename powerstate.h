@@ -0,0 +1,22 @@
+/**
+ * @file powerstate.h
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Transitions of the power state machine, free of platform dependencies to be tested on the host.
+ *
+ */
+
+#ifndef _POWERSTATE_H_
+#define _POWERSTATE_H_
+
+#include <stdint.h>
+
+enum class PowerState : uint8_t {BOOT, SYNCING, INTERACTIVE, DRAINING, SLEEP};
+
+// outstanding work which keeps the device awake
+#define WORK_BLE 0x01       // BLE scan or connection in progress
+#define WORK_USER 0x02      // user works with a sub screen
+
+PowerState powerNext(PowerState state, uint8_t work, bool idle, uint32_t awake);
+
+#endif
@@ -0,0 +1,200 @@
+/**
+ * @file refresh.cpp
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Refresh policy to handle ghosting of the e-ink display.
+ *
+ * Quick refreshes leave ghosting, which grows with the number of refreshes and changed pixels.
+ * The history is kept per screen region across deep sleep and selects the refresh:
+ * - Quick refresh for small changes
+ * - Quick refresh with one repetition for changes of large parts of a region, e.g. screen transitions
+ * - Full refresh of a region after too many partial refreshes or changed pixels
+ * - Full refresh of the screen once a day at a quiet time
+ * The waveform of quick refreshes is chosen per region.
+ */
+
+#include <Arduino.h>
+#include <TimeLib.h>
+#include <epd4in2.h>
+#include "configuration.h"
+#include "framestore.h"
+#include "hmi.h"
+#include "refresh.h"
+
+#define REGIONS 3
+
+/**
+ * @brief Region of screen with own refresh history.
+ * 
+ */
+struct Region {
+  uint16_t first;
+  uint16_t last;
+  Waveform waveform;    // waveform of quick refresh
+};
+
+/**
+ * @brief Refresh history of a region since last full refresh.
+ * 
+ */
+struct RegionHistory {
+  uint16_t partials;    // number of partial refreshes
+  uint32_t ghosting;    // changed pixels
+};
+
+// the headline with the clock is refreshed most frequently with the cheapest waveform. It drives unchanged
+// pixels as well, so the partial refreshes of the headline are limited by MAX_PARTIAL_REFRESHES besides the ghosting.
+static const struct Region regions[REGIONS] = {
+  {0, R1_Y, Waveform::FAST}, 
+  {R1_Y+1, R2_Y, Waveform::BALANCED}, 
+  {R2_Y+1, R3_Y-1, Waveform::BALANCED}
+};
+RTC_DATA_ATTR struct RegionHistory history[REGIONS];
+RTC_DATA_ATTR uint8_t cleanupDay = 0;
+static uint32_t pendingPixels[REGIONS];     // changed pixels not yet refreshed
+
+/**
+ * @brief Check if a region overlaps rows.
+ * 
+ * @param region 
+ * @param first First row.
+ * @param last Last row.
+ * @return true Region overlaps the rows.
+ */
+static bool overlaps(uint8_t region, uint16_t first, uint16_t last){
+  return regions[region].first <= last && regions[region].last >= first;
+}
+
+/**
+ * @brief Size of region in pixels.
+ * 
+ * @param region 
+ * @return uint32_t 
+ */
+static uint32_t regionPixels(uint8_t region){
+  return (uint32_t)(regions[region].last - regions[region].first + 1) * EPD_WIDTH;
+}
+
+/**
+ * @brief Register changed rows of a new frame. Changed pixels are taken from the frame store.
+ * 
+ * @param first First changed row.
+ * @param last Last changed row.
+ */
+void refreshChanged(uint16_t first, uint16_t last){
+  for (uint8_t r=0; r<REGIONS; r++){
+    if (overlaps(r, first, last)){
+      pendingPixels[r] += frameChangedPixels(max(first, regions[r].first), min(last, regions[r].last));
+    }
+  }
+}
+
+/**
+ * @brief Check if the daily full refresh is due.
+ * 
+ * @return true Full refresh of the screen is due.
+ */
+static bool cleanupDue(){
+  return hour() == CLEANUP_HOUR && cleanupDay != day() && year() >= 2016;
+}
+
+/**
+ * @brief Check if the ghosting of a region requires a full refresh.
+ * 
+ * @param region 
+ * @return true Full refresh of the region is due.
+ */
+static bool fullRefreshDue(uint8_t region){
+  return history[region].partials >= MAX_PARTIAL_REFRESHES || 
+    history[region].ghosting + pendingPixels[region] >= MAX_GHOSTING*regionPixels(region);
+}
+
+/**
+ * @brief Select refresh for rows and update the refresh history. Rows are extended to whole regions for a full refresh.
+ * 
+ * @param first First row to be refreshed.
+ * @param last Last row to be refreshed.
+ * @return Refresh 
+ */
+Refresh refreshPlan(uint16_t* first, uint16_t* last){
+  Refresh refresh = Refresh::QUICK;
+  uint32_t changed = 0;
+  uint32_t size = 0;
+  bool cleanup = cleanupDue();
+  if (cleanup){
+    cleanupDay = day();
+  }
+  for (uint8_t r=0; r<REGIONS; r++){
+    if (!overlaps(r, *first, *last) && !cleanup){
+      continue;
+    }
+    if (cleanup || fullRefreshDue(r)){
+      refresh = Refresh::FULL;
+      *first = min(*first, regions[r].first);
+      *last = max(*last, regions[r].last);
+    }
+    changed += pendingPixels[r];
+    size += regionPixels(r);
+  }
+  if (refresh != Refresh::FULL && changed*100 >= size*DOUBLE_REFRESH_CHANGE){
+    refresh = Refresh::DOUBLE;
+  }
+  for (uint8_t r=0; r<REGIONS; r++){
+    if (overlaps(r, *first, *last)){
+      if (refresh == Refresh::FULL){
+        history[r].partials = 0;
+        history[r].ghosting = 0;
+      } else {
+        history[r].partials++;
+        history[r].ghosting += pendingPixels[r];
+      }
+      pendingPixels[r] = 0;
+    }
+  }
+  return refresh;
+}
+
+/**
+ * @brief Register a quick refresh of a window outside of the frame store, e.g. the prerendered clock.
+ * 
+ * @param y Top row of window.
+ * @param pixels Changed pixels.
+ * @return true Quick refresh registered.
+ * @return false Full refresh is due, the screen has to be drawn instead.
+ */
+bool refreshWindow(uint16_t y, uint32_t pixels){
+  if (cleanupDue()){
+    return false;
+  }
+  for (uint8_t r=0; r<REGIONS; r++){
+    if (overlaps(r, y, y)){
+      if (fullRefreshDue(r)){
+        return false;
+      }
+      history[r].partials++;
+      history[r].ghosting += pixels;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Select waveform for a refresh of rows. Quick refreshes use the slowest waveform of the covered regions.
+ * 
+ * @param refresh Refresh selected by refreshPlan().
+ * @param first First row.
+ * @param last Last row.
+ * @return Waveform 
+ */
+Waveform refreshWaveform(Refresh refresh, uint16_t first, uint16_t last){
+  if (refresh == Refresh::FULL){
+    return Waveform::FULL;
+  }
+  Waveform waveform = Waveform::FAST;
+  for (uint8_t r=0; r<REGIONS; r++){
+    if (overlaps(r, first, last) && regions[r].waveform > waveform){
+      waveform = regions[r].waveform;
+    }
+  }
+  return waveform;
+}
@@ -0,0 +1,22 @@
+/**
+ * @file refresh.h
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Refresh policy to handle ghosting of the e-ink display.
+ *
+ */
+
+#ifndef _REFRESH_H_
+#define _REFRESH_H_
+
+#include <Arduino.h>
+#include "display.h"
+
+enum class Refresh : uint8_t {QUICK, DOUBLE, FULL};
+
+void refreshChanged(uint16_t first, uint16_t last);
+Refresh refreshPlan(uint16_t* first, uint16_t* last);
+bool refreshWindow(uint16_t y, uint32_t pixels);
+Waveform refreshWaveform(Refresh refresh, uint16_t first, uint16_t last);
+
+#endif
@@ -0,0 +1,169 @@
+/**
+ * @file rooms.cpp
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Registry of rooms and window states.
+ *
+ * The window state is read with each synchronization and scales with the number of rooms:
+ * - 1 byte version of the room registry
+ * - 1 byte number of rooms
+ * - 2 bits per room, 4 rooms per byte starting with the low bits, as in enum WindowState
+ * 
+ * Names and floors of the rooms are read only if the version of the registry changes:
+ * - 1 byte version of the room registry
+ * - per room 1 byte floor and the zero terminated name
+ * 
+ * Without registry, the rooms of the former fixed room list are used.
+ */
+
+#include <Arduino.h>
+#include "btcom.h"
+#include "rtcstate.h"
+#include "rooms.h"
+
+#define WINDOWS_HEADER 2
+
+// rooms of the server without room registry
+static const struct {const char* name; uint8_t floor;} legacyRooms[] = {
+  {"Wohnzimmer", 0}, {"Esszimmer", 0}, {"Kueche", 0}, {"Schlafz.", 0}, {"Bad", 0}, 
+  {"Flur", 0}, {"Bad OG", 1}, {"Flur OG", 1}, {"Svenja", 1}, {"Robin", 1}
+};
+#define LEGACY_ROOMS (sizeof(legacyRooms)/sizeof(legacyRooms[0]))
+
+/**
+ * @brief Store received room registry in the RTC state. Called by the sync task. 
+ *  An invalid registry is dropped and requested again with the next window state.
+ * 
+ * @param data Encoded registry.
+ * @param length 
+ */
+void roomsStore(const uint8_t* data, uint16_t length){
+  struct RoomRegistry* registry = &rtcState.rooms;
+  if (length < 1){
+    Serial.println("Invalid room registry");
+    portENTER_CRITICAL(&statusMux);
+    memset(registry, 0, sizeof(struct RoomRegistry));
+    portEXIT_CRITICAL(&statusMux);
+    return;
+  }
+  uint16_t pos = 1;
+  uint16_t namePos = 0;
+  uint8_t count = 0;
+  portENTER_CRITICAL(&statusMux);
+  memset(registry, 0, sizeof(struct RoomRegistry));
+  while (pos < length && count < ROOMS_MAX){
+    const char* name = (const char*)data + pos + 1;
+    uint16_t nameLength = strnlen(name, length - pos - 1);
+    if (pos + 1 + nameLength >= length || namePos + nameLength + 1 > ROOM_NAMES_SIZE){
+      break;    // name not terminated or no space left
+    }
+    registry->floors[count] = data[pos];
+    memcpy(registry->names + namePos, name, nameLength + 1);
+    namePos += nameLength + 1;
+    pos += nameLength + 2;
+    count++;
+  }
+  registry->count = count;
+  registry->version = data[0];
+  portEXIT_CRITICAL(&statusMux);
+  if (pos < length){
+    Serial.println("Room registry truncated");
+  }
+}
+
+/**
+ * @brief Check if the stored room registry is up to date.
+ * 
+ * @param version Version of the registry on the server.
+ * @return true Registry received with this version.
+ */
+bool roomsValid(uint8_t version){
+  return rtcState.rooms.count > 0 && rtcState.rooms.version == version;
+}
+
+/**
+ * @brief Store received window state into status.
+ * 
+ * @param status 
+ * @param data Encoded window state.
+ * @param length 
+ */
+void windowsStore(struct Status* status, const uint8_t* data, uint16_t length){
+  if (length < WINDOWS_HEADER){
+    Serial.println("Invalid window state");
+    return;
+  }
+  uint8_t count = min((uint16_t)min(data[1], (uint8_t)ROOMS_MAX), (uint16_t)((length - WINDOWS_HEADER)*4));
+  memset(status->windows, 0, sizeof(status->windows));
+  memcpy(status->windows, data + WINDOWS_HEADER, (count + 3)/4);
+  status->roomCount = count;
+}
+
+/**
+ * @brief Store window state of the former characteristic with one byte per room.
+ * 
+ * @param status 
+ * @param data One byte per room, low 2 bits as in enum WindowState.
+ * @param length 
+ */
+void windowsStoreLegacy(struct Status* status, const uint8_t* data, uint16_t length){
+  uint8_t count = min(length, (uint16_t)LEGACY_ROOMS);
+  memset(status->windows, 0, sizeof(status->windows));
+  for (uint8_t room=0; room<count; room++){
+    status->windows[room/4] |= (data[room] & 0x03) << 2*(room%4);
+  }
+  status->roomCount = count;
+}
+
+/**
+ * @brief Get window state of a room.
+ * 
+ * @param status 
+ * @param room Index of room.
+ * @return enum WindowState 
+ */
+enum WindowState windowState(const struct Status* status, uint8_t room){
+  if (room >= status->roomCount){
+    return WindowState::UNKNOWN;
+  }
+  return (enum WindowState)(status->windows[room/4] >> 2*(room%4) & 0x03);
+}
+
+/**
+ * @brief Get floor of a room.
+ * 
+ * @param registry Stored registry or snapshot.
+ * @param room Index of room.
+ * @return uint8_t Floor, 0 if unknown.
+ */
+uint8_t roomFloor(const struct RoomRegistry* registry, uint8_t room){
+  if (registry->count == 0){
+    return room < LEGACY_ROOMS ? legacyRooms[room].floor : 0;
+  }
+  return room < registry->count ? registry->floors[room] : 0;
+}
+
+/**
+ * @brief Get name of a room.
+ * 
+ * @param registry Stored registry or snapshot.
+ * @param room Index of room.
+ * @param buffer Destination of the name, generic name if unknown.
+ * @param size Size of buffer.
+ */
+void roomName(const struct RoomRegistry* registry, uint8_t room, char* buffer, uint8_t size){
+  const char* name = nullptr;
+  if (registry->count == 0){
+    name = room < LEGACY_ROOMS ? legacyRooms[room].name : nullptr;
+  } else if (room < registry->count){
+    name = registry->names;
+    for (uint8_t i=0; i<room; i++){
+      name += strlen(name) + 1;
+    }
+  }
+  if (name != nullptr){
+    snprintf(buffer, size, "%s", name);
+  } else {
+    snprintf(buffer, size, "Raum %d", room + 1);
+  }
+}
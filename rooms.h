@@ -0,0 +1,41 @@
+/**
+ * @file rooms.h
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Registry of rooms and window states.
+ *
+ */
+
+#ifndef _ROOMS_H_
+#define _ROOMS_H_
+
+#include <Arduino.h>
+
+#define ROOMS_MAX 64              // rooms of window state, 2 bits each
+#define ROOM_NAMES_SIZE 512       // all room names including terminating zeros
+#define ROOM_NAME_LENGTH 12       // max characters of a room name shown
+
+enum WindowState : uint8_t {CLOSED, OPEN, TILTED, UNKNOWN};
+
+/**
+ * @brief Room names and floors as received from the server, identified by version.
+ * 
+ */
+struct RoomRegistry {
+  uint8_t version;                // version of the server, 0 if not received
+  uint8_t count;                  // number of rooms, 0 if not received
+  uint8_t floors[ROOMS_MAX];
+  char names[ROOM_NAMES_SIZE];    // zero terminated names in order of rooms
+};
+
+struct Status;
+
+void roomsStore(const uint8_t* data, uint16_t length);
+bool roomsValid(uint8_t version);
+void windowsStore(struct Status* status, const uint8_t* data, uint16_t length);
+void windowsStoreLegacy(struct Status* status, const uint8_t* data, uint16_t length);
+enum WindowState windowState(const struct Status* status, uint8_t room);
+uint8_t roomFloor(const struct RoomRegistry* registry, uint8_t room);
+void roomName(const struct RoomRegistry* registry, uint8_t room, char* buffer, uint8_t size);
+
+#endif
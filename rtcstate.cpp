@@ -0,0 +1,51 @@
+/**
+ * @file rtcstate.cpp
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Persistent state in RTC memory, which is kept during deep sleep.
+ *
+ * - The state is sealed with a CRC before deep sleep and validated after wakeup
+ * - A layout change after reflash is detected by version and size
+ * - An invalid state is reset to the cold boot state
+ */
+
+#include <Arduino.h>
+#include <rom/crc.h>
+#include "rtcstate.h"
+
+RTC_DATA_ATTR struct RtcState rtcState;
+
+/**
+ * @brief Calculate CRC over all fields except the CRC.
+ * 
+ * @return uint32_t 
+ */
+static uint32_t rtcStateCrc(){
+  return crc32_le(0, (const uint8_t*)&rtcState, offsetof(struct RtcState, crc));
+}
+
+/**
+ * @brief Validate state after wakeup. Reset to cold boot state if it is invalid.
+ * 
+ * @return true State is valid.
+ * @return false State was reset.
+ */
+bool rtcStateValidate(){
+  if (rtcState.version == RTC_STATE_VERSION && rtcState.size == sizeof(struct RtcState) && rtcState.crc == rtcStateCrc()){
+    return true;
+  }
+  memset(&rtcState, 0, sizeof(struct RtcState));
+  rtcState.version = RTC_STATE_VERSION;
+  rtcState.size = sizeof(struct RtcState);
+  rtcState.pmHour = PM_INVALID;
+  rtcState.status.nextGarbageCollection = {GarbageType::UNDEFINED, 255};
+  return false;
+}
+
+/**
+ * @brief Seal state with CRC before deep sleep.
+ * 
+ */
+void rtcStateSeal(){
+  rtcState.crc = rtcStateCrc();
+}
@@ -0,0 +1,45 @@
+/**
+ * @file rtcstate.h
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Persistent state in RTC memory, which is kept during deep sleep.
+ *
+ */
+
+#ifndef _RTCSTATE_H_
+#define _RTCSTATE_H_
+
+#include <Arduino.h>
+#include "btcom.h"
+#include "timetable.h"
+#include "garbage.h"
+#include "history.h"
+#include "rooms.h"
+
+// increment with each change of struct RtcState
+#define RTC_STATE_VERSION 8
+
+/**
+ * @brief State kept during deep sleep. Protected by version, size and CRC.
+ * 
+ */
+struct RtcState {
+  uint16_t version;
+  uint16_t size;
+  int bootCount;                // wakeups since cold boot, 0 for cold boot
+  uint8_t pmHour;               // party mode end to be sent, PM_INVALID if sent
+  uint8_t pmMinute;
+  struct Status status;         // last received status
+  struct Timetable timetable;   // timetable of the day
+  struct GarbageCalendar garbage; // garbage collection dates
+  struct History history;       // temperature and humidity of last 24 h
+  struct RoomRegistry rooms;    // room names and floors
+  uint32_t crc;                 // over all previous fields
+};
+
+extern struct RtcState rtcState;
+
+bool rtcStateValidate();
+void rtcStateSeal();
+
+#endif
@@ -0,0 +1,110 @@
+/**
+ * @file telemetry.cpp
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Stack and heap watermarks to size tasks and buffers.
+ *
+ * - Stack high water mark of each task, sampled by the task itself
+ * - Free heap and largest free block per power state
+ * - Watermarks of the current wakeup and worst case since cold boot in RTC memory
+ * - Report as single serial lines with prefix "TELEMETRY", one value per comma separated column
+ */
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include "telemetry.h"
+
+/**
+ * @brief Watermarks in bytes. 0 if not sampled.
+ * 
+ */
+struct Telemetry {
+  uint32_t stack[TELEMETRY_TASKS];      // lowest unused stack
+  uint32_t heap[TELEMETRY_PHASES];      // lowest free heap
+  uint32_t block[TELEMETRY_PHASES];     // smallest largest free block
+};
+
+RTC_DATA_ATTR struct Telemetry worstCase;  // since cold boot
+RTC_DATA_ATTR uint16_t reports = 0;
+static struct Telemetry current;           // of this wakeup
+
+/**
+ * @brief Lower a watermark.
+ * 
+ * @param mark Watermark, 0 if not sampled.
+ * @param value Sampled value.
+ */
+static void lower(uint32_t* mark, uint32_t value){
+  if (*mark == 0 || value < *mark){
+    *mark = value;
+  }
+}
+
+/**
+ * @brief Sample stack high water mark of the calling task.
+ * 
+ * @param task TASK_...
+ */
+void telemetryStack(uint8_t task){
+  uint32_t unused = uxTaskGetStackHighWaterMark(nullptr);
+  lower(&current.stack[task], unused);
+  lower(&worstCase.stack[task], unused);
+}
+
+/**
+ * @brief Sample free heap and largest free block.
+ * 
+ * @param phase Power state.
+ */
+void telemetryHeap(uint8_t phase){
+  uint32_t free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  uint32_t block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  lower(&current.heap[phase], free);
+  lower(&worstCase.heap[phase], free);
+  lower(&current.block[phase], block);
+  lower(&worstCase.block[phase], block);
+}
+
+/**
+ * @brief Print watermarks.
+ * 
+ * @param name 
+ * @param telemetry 
+ */
+static void print(const char* name, struct Telemetry* telemetry){
+  Serial.print("TELEMETRY,");
+  Serial.print(reports);
+  Serial.print(",");
+  Serial.print(name);
+  Serial.print(",stack");
+  for (uint8_t i=0; i<TELEMETRY_TASKS; i++){
+    Serial.print(",");
+    Serial.print(telemetry->stack[i]);
+  }
+  Serial.print(",heap");
+  for (uint8_t i=0; i<TELEMETRY_PHASES; i++){
+    Serial.print(",");
+    Serial.print(telemetry->heap[i]);
+  }
+  Serial.print(",block");
+  for (uint8_t i=0; i<TELEMETRY_PHASES; i++){
+    Serial.print(",");
+    Serial.print(telemetry->block[i]);
+  }
+  Serial.println();
+}
+
+/**
+ * @brief Report watermarks of the current wakeup and the worst case since cold boot.
+ * 
+ */
+void telemetryReport(){
+  telemetryStack(TASK_LOOP);
+  reports++;
+  print("wake", &current);
+  print("worst", &worstCase);
+  Serial.print("TELEMETRY,");
+  Serial.print(reports);
+  Serial.print(",heap min free ");
+  Serial.println(esp_get_minimum_free_heap_size());
+}
@@ -0,0 +1,27 @@
+/**
+ * @file telemetry.h
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Stack and heap watermarks to size tasks and buffers.
+ *
+ */
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <Arduino.h>
+
+// sampled tasks
+#define TASK_LOOP 0
+#define TASK_EVENTLOOP 1
+#define TASK_SYNC 2
+#define TELEMETRY_TASKS 3
+
+// phases are the power states
+#define TELEMETRY_PHASES 5
+
+void telemetryStack(uint8_t task);
+void telemetryHeap(uint8_t phase);
+void telemetryReport();
+
+#endif
@@ -0,0 +1,52 @@
+/**
+ * @file powerstate_test.cpp
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Host test of the power state transitions. Run with make -C test.
+ *
+ */
+
+#include <stdio.h>
+#include "../powerstate.h"
+#include "../configuration.h"
+
+static int failures = 0;
+
+/**
+ * @brief Compare a transition with the expected state.
+ * 
+ * @param name Description of transition.
+ * @param actual 
+ * @param expected 
+ */
+static void expect(const char* name, PowerState actual, PowerState expected){
+  if (actual != expected){
+    printf("FAIL %s: %d instead of %d\n", name, (int)actual, (int)expected);
+    failures++;
+  }
+}
+
+int main(){
+  // regular wakeup: BOOT -> SYNCING -> INTERACTIVE -> DRAINING -> SLEEP
+  expect("boot with sync", powerNext(PowerState::BOOT, WORK_BLE, true, 0), PowerState::SYNCING);
+  expect("user during sync", powerNext(PowerState::SYNCING, WORK_BLE | WORK_USER, false, 100), PowerState::INTERACTIVE);
+  expect("sync ends while interactive", powerNext(PowerState::INTERACTIVE, WORK_USER, false, 200), PowerState::INTERACTIVE);
+  expect("sync continues while interactive", powerNext(PowerState::INTERACTIVE, WORK_BLE, false, 300), PowerState::INTERACTIVE);
+  expect("user leaves with pending frame", powerNext(PowerState::INTERACTIVE, 0, false, 400), PowerState::DRAINING);
+  expect("drained", powerNext(PowerState::DRAINING, 0, true, 500), PowerState::SLEEP);
+
+  // shortcuts
+  expect("boot without work", powerNext(PowerState::BOOT, 0, true, 0), PowerState::SLEEP);
+  expect("boot with pending frame", powerNext(PowerState::BOOT, 0, false, 0), PowerState::DRAINING);
+  expect("sync finished", powerNext(PowerState::SYNCING, 0, false, 100), PowerState::DRAINING);
+  expect("sleep is final", powerNext(PowerState::SLEEP, WORK_BLE | WORK_USER, false, 0), PowerState::SLEEP);
+
+  // AWAKE_TIMEOUT overrides outstanding work, e.g. if the BLE server does not respond
+  expect("before timeout", powerNext(PowerState::SYNCING, WORK_BLE, false, AWAKE_TIMEOUT - 1), PowerState::SYNCING);
+  expect("sync timeout", powerNext(PowerState::SYNCING, WORK_BLE, false, AWAKE_TIMEOUT), PowerState::SLEEP);
+  expect("user timeout", powerNext(PowerState::INTERACTIVE, WORK_USER, false, AWAKE_TIMEOUT), PowerState::SLEEP);
+  expect("drain timeout", powerNext(PowerState::DRAINING, 0, false, AWAKE_TIMEOUT), PowerState::SLEEP);
+
+  printf("%s\n", failures == 0 ? "OK" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file timesync.cpp
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief System time with minute alignment and RTC drift compensation.
+ *
+ * - The ESP32 RTC continues during deep sleep and provides the system time
+ * - Drift of the RTC is estimated from successive time synchronizations with the server
+ * - Estimated drift is applied to the system time after each wakeup
+ * - Wakeup is scheduled just before the next minute starts
+ */
+
+#include <Arduino.h>
+#include <TimeLib.h>
+#include <sys/time.h>
+#include "configuration.h"
+#include "timesync.h"
+
+#define US_PER_S 1000000LL
+#define US_PER_MINUTE (60*US_PER_S)
+#define WAKE_LEAD_US 300000         // wakeup before minute starts to compensate boot time
+#define MIN_DRIFT_INTERVAL_US (60*US_PER_MINUTE)
+#define MAX_DRIFT_PPB 10000000      // 1%, larger values are measurement errors
+#define MIN_CORRECTION_US 1000
+
+RTC_DATA_ATTR int64_t lastSync = 0;         // system time of last synchronization with server in us
+RTC_DATA_ATTR int64_t lastCorrection = 0;   // system time of last drift correction in us
+RTC_DATA_ATTR int64_t driftStart = 0;       // server time at start of drift measurement in us
+RTC_DATA_ATTR int64_t driftOffset = 0;      // sum of time offsets since start of drift measurement in us
+RTC_DATA_ATTR int32_t driftPpb = 0;         // RTC drift, positive if RTC is slow
+RTC_DATA_ATTR uint8_t driftSamples = 0;
+
+/**
+ * @brief Get system time in microseconds
+ * 
+ * @return int64_t 
+ */
+static int64_t getSystemTime(){
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return tv.tv_sec*US_PER_S + tv.tv_usec;
+}
+
+/**
+ * @brief Set system time in microseconds
+ * 
+ * @param time 
+ */
+static void setSystemTime(int64_t time){
+  struct timeval tv;
+  tv.tv_sec = time/US_PER_S;
+  tv.tv_usec = time%US_PER_S;
+  settimeofday(&tv, nullptr);
+}
+
+/**
+ * @brief Apply drift correction to system time and set TimeLib time. Shall be called first after wakeup.
+ *  TimeLib time is rounded to the minute which starts within the wakeup lead time, 
+ *  so the display shows the new minute if the device wakes up just before.
+ * 
+ */
+void timeInit(){
+  int64_t time = getSystemTime();
+  if (lastCorrection != 0){
+    int64_t correction = (time - lastCorrection) * driftPpb / 1000000000LL;
+    if (correction >= MIN_CORRECTION_US || correction <= -MIN_CORRECTION_US){
+      time += correction;
+      setSystemTime(time);
+      lastCorrection = time;
+    }
+  }
+  setTime((time + WAKE_LEAD_US)/US_PER_S);
+}
+
+/**
+ * @brief Synchronize system time with server time and update the drift estimation.
+ * 
+ * @param serverTime Time received from server.
+ * @param usec Fraction of second received from server.
+ */
+void timeSync(time_t serverTime, uint32_t usec){
+  int64_t server = serverTime*US_PER_S + usec;
+  int64_t offset = server - getSystemTime();
+  if (lastSync == 0){
+    driftStart = server;
+    driftOffset = 0;
+  } else {
+    driftOffset += offset;
+  }
+  int64_t interval = server - driftStart;
+  if (interval >= MIN_DRIFT_INTERVAL_US){
+    // remaining drift after correction during measurement interval
+    int64_t drift = driftPpb + driftOffset * 1000000000LL / interval;
+    if (drift < MAX_DRIFT_PPB && drift > -MAX_DRIFT_PPB){
+      // average with previous estimation after first sample
+      driftPpb = driftSamples == 0 ? drift : (driftPpb + drift)/2;
+      if (driftSamples < 255){
+        driftSamples++;
+      }
+    }
+    driftStart = server;
+    driftOffset = 0;
+  }
+  setSystemTime(server);
+  setTime(serverTime);
+  lastSync = server;
+  lastCorrection = server;
+  Serial.print("Time offset [us]: ");
+  Serial.print((int32_t)offset);
+  Serial.print(" drift [ppb]: ");
+  Serial.println(driftPpb);
+}
+
+/**
+ * @brief Check if time shall be read from server. Without drift estimation the time is synchronized each connection.
+ * 
+ * @return true Synchronization required.
+ * @return false Time is accurate enough.
+ */
+bool timeSyncDue(){
+  if (lastSync == 0 || driftSamples < 2 || year() < 2016){
+    return true;
+  }
+  return (getSystemTime() - lastSync) >= TIME_SYNC_INTERVAL*60*US_PER_MINUTE;
+}
+
+/**
+ * @brief Get sleep duration for wakeup just before the next minute starts, compensated by the RTC drift.
+ * 
+ * @return uint64_t Sleep duration in microseconds.
+ */
+uint64_t timeToNextMinute(){
+  int64_t time = getSystemTime();
+  int64_t wakeup = ((time + WAKE_LEAD_US)/US_PER_MINUTE + 1)*US_PER_MINUTE - WAKE_LEAD_US;
+  int64_t duration = wakeup - time;
+  return duration - duration * driftPpb / 1000000000LL;
+}
@@ -0,0 +1,20 @@
+/**
+ * @file timesync.h
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief System time with minute alignment and RTC drift compensation.
+ *
+ */
+
+#ifndef _TIMESYNC_H_
+#define _TIMESYNC_H_
+
+#include <Arduino.h>
+#include <TimeLib.h>
+
+void timeInit();
+void timeSync(time_t serverTime, uint32_t usec);
+bool timeSyncDue();
+uint64_t timeToNextMinute();
+
+#endif
@@ -0,0 +1,152 @@
+/**
+ * @file timetable.cpp
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Timetable of the day to derive the next departures locally.
+ *
+ * The server sends the timetable of the configured routes once a day in a single read. A route is a line 
+ * of any transport type at one stop. The timetable is kept in the RTC state, the next departures of all 
+ * routes are derived from the current time without synchronization.
+ * 
+ * Encoding:
+ * - 1 byte number of routes
+ * - per route:
+ *   - 2 bytes line number and transport type as in struct Schedule
+ *   - 1 byte travel time in minutes
+ *   - 1 byte number of departures
+ *   - 1 byte per departure in ascending order, minutes since previous departure, since midnight for the first one.
+ *     255 adds 255 minutes without departure.
+ */
+
+#include <Arduino.h>
+#include <TimeLib.h>
+#include "btcom.h"
+#include "rtcstate.h"
+#include "timetable.h"
+
+#define DELTA_SKIP 255
+#define ROUTE_HEADER 4
+
+/**
+ * @brief Check if encoded timetable is complete and consistent.
+ * 
+ * @param data 
+ * @param length 
+ * @return true Timetable can be decoded.
+ */
+static bool timetableCheck(const uint8_t* data, uint16_t length){
+  if (length < 1 || length > TIMETABLE_SIZE || data[0] == 0 || data[0] > TIMETABLE_ROUTES){
+    return false;
+  }
+  uint16_t pos = 1;
+  for (uint8_t route=0; route<data[0]; route++){
+    if (pos + ROUTE_HEADER > length){
+      return false;
+    }
+    pos += ROUTE_HEADER + data[pos+3];
+  }
+  return pos == length;
+}
+
+/**
+ * @brief Store received timetable of a day in the RTC state. Called by the sync task.
+ * 
+ * @param data Encoded timetable.
+ * @param length 
+ * @param day Time of the day the timetable is valid.
+ */
+void timetableStore(const uint8_t* data, uint16_t length, time_t day){
+  struct Timetable* timetable = &rtcState.timetable;
+  bool valid = timetableCheck(data, length);
+  if (!valid){
+    Serial.println("Invalid timetable");
+  }
+  portENTER_CRITICAL(&statusMux);
+  if (valid){
+    memcpy(timetable->data, data, length);
+    timetable->length = length;
+    timetable->day = previousMidnight(day);
+  } else {
+    timetable->day = 0;
+  }
+  portEXIT_CRITICAL(&statusMux);
+}
+
+/**
+ * @brief Check if a timetable of the day is stored.
+ * 
+ * @param timetable Stored timetable or snapshot.
+ * @param time 
+ * @return true Departures can be derived for the day.
+ */
+bool timetableValid(const struct Timetable* timetable, time_t time){
+  return timetable->day != 0 && timetable->day == previousMidnight(time);
+}
+
+/**
+ * @brief Get next departures of all routes.
+ * 
+ * @param timetable Stored timetable or snapshot.
+ * @param time Current time.
+ * @param schedules Next departures in ascending order.
+ * @param count Max number of departures.
+ * @return uint8_t Number of departures, 0 if no valid timetable is available.
+ */
+uint8_t timetableNext(const struct Timetable* timetable, time_t time, struct Schedule* schedules, uint8_t count){
+  if (!timetableValid(timetable, time) || count == 0){
+    return 0;
+  }
+  const uint8_t* data = timetable->data;
+  uint16_t minuteOfDay = elapsedSecsToday(time)/SECS_PER_MIN;
+  uint8_t found = 0;
+  uint16_t pos = 1;
+  for (uint8_t route=0; route<data[0]; route++){
+    const uint8_t* header = data + pos;
+    pos += ROUTE_HEADER + header[3];
+    uint16_t departure = 0;
+    for (uint8_t i=0; i<header[3]; i++){
+      departure += header[ROUTE_HEADER + i];
+      if (header[ROUTE_HEADER + i] == DELTA_SKIP || departure < minuteOfDay){
+        continue;
+      }
+      if (found == count && departure >= schedules[count-1].departure){
+        break;      // later than all departures found
+      }
+      // insert in order of departure
+      uint8_t j = found < count ? found++ : count - 1;
+      for (; j>0 && schedules[j-1].departure > departure; j--){
+        schedules[j] = schedules[j-1];
+      }
+      uint16_t lineType = header[0] | header[1] << 8;
+      schedules[j].departure = departure;
+      schedules[j].arrival = departure + header[2];
+      schedules[j].line = lineType & 0x1fff;
+      schedules[j].type = (enum Transport)(lineType >> 13);
+    }
+  }
+  return found;
+}
+
+/**
+ * @brief Check if the next departures change between two times.
+ * 
+ * @param timetable Stored timetable or snapshot.
+ * @param from 
+ * @param to 
+ * @return true Departures are different.
+ */
+bool timetableChanged(const struct Timetable* timetable, time_t from, time_t to){
+  struct Schedule before[TIMETABLE_NEXT];
+  struct Schedule after[TIMETABLE_NEXT];
+  uint8_t countBefore = timetableNext(timetable, from, before, TIMETABLE_NEXT);
+  uint8_t countAfter = timetableNext(timetable, to, after, TIMETABLE_NEXT);
+  if (countBefore != countAfter){
+    return true;
+  }
+  for (uint8_t i=0; i<countBefore; i++){
+    if (before[i].departure != after[i].departure || before[i].line != after[i].line){
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,36 @@
+/**
+ * @file timetable.h
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Timetable of the day to derive the next departures locally.
+ *
+ */
+
+#ifndef _TIMETABLE_H_
+#define _TIMETABLE_H_
+
+#include <Arduino.h>
+#include <TimeLib.h>
+
+#define TIMETABLE_SIZE 512        // bytes of delta encoded timetable, max length of a GATT value
+#define TIMETABLE_ROUTES 16       // max routes per timetable
+#define TIMETABLE_NEXT 3          // departures shown
+
+/**
+ * @brief Delta encoded timetable of a day as received from the server.
+ * 
+ */
+struct Timetable {
+  time_t day;                     // midnight of the day the timetable is valid, 0 if invalid
+  uint16_t length;
+  uint8_t data[TIMETABLE_SIZE];
+};
+
+struct Schedule;
+
+void timetableStore(const uint8_t* data, uint16_t length, time_t day);
+bool timetableValid(const struct Timetable* timetable, time_t time);
+uint8_t timetableNext(const struct Timetable* timetable, time_t time, struct Schedule* schedules, uint8_t count);
+bool timetableChanged(const struct Timetable* timetable, time_t from, time_t to);
+
+#endif
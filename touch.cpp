@@ -4,22 +4,72 @@
  * @date 9 Feb 2018
  * @brief Driver for touch buttons.
  *
+ * - Touch interrupt wakes the polling task, the pads are only polled while a button is pressed
+ * - Filter mode of the touch peripheral
+ * - Baseline of each pad is tracked in RTC memory to compensate drift by humidity and temperature.
+ *   The threshold is set relative to the baseline, for deep sleep wakeup as well
+ * - Touch wakeups are confirmed by sampling the pad before display and BLE are powered, 
+ *   moisture or a hand brushing past are rejected
  * - Debouncing 
  * - Event notification
  */
  
+#include "configuration.h"
 #include "touch.h"
 
+RTC_DATA_ATTR uint16_t touchBaseline[TOUCH_PAD_MAX];   // untouched pad value, 0 if not calibrated
+RTC_DATA_ATTR uint16_t touchWakes = 0;                // statistics of touch wakeups
+RTC_DATA_ATTR uint16_t rejectedWakes = 0;
+static TaskHandle_t touchTask = nullptr;
+
+/**
+ * @brief Interrupt handler of the touch peripheral. Wakes the task waiting in touchWait().
+ * 
+ * @param arg Not used.
+ */
+static void IRAM_ATTR touchIsr(void* arg){
+  BaseType_t woken = pdFALSE;
+  touch_pad_clear_status();
+  vTaskNotifyGiveFromISR(touchTask, &woken);
+  if (woken){
+    portYIELD_FROM_ISR();
+  }
+}
+
+/**
+ * @brief Init touch peripheral with filter and interrupt. Has to be called by the task which calls touchWait() 
+ *  before the buttons are configured.
+ * 
+ */
+void touchBegin(){
+  touchTask = xTaskGetCurrentTaskHandle();
+  touch_pad_init();
+  touch_pad_set_fsm_mode(TOUCH_FSM_MODE_TIMER);
+  touch_pad_filter_start(TOUCH_FILTER_PERIOD);
+  touch_pad_isr_register(touchIsr, nullptr);
+  touch_pad_intr_enable();
+}
+
+/**
+ * @brief Block until a touch interrupt occurs or the ticks expired.
+ * 
+ * @param ticks Max ticks to wait.
+ */
+void touchWait(TickType_t ticks){
+  ulTaskNotifyTake(pdTRUE, ticks);
+}
+
 /**
  * @brief Constructor for touch input object.
  * 
  * @param pin PIN of touch input.
- * @param threshold Touchthreshold.
+ * @param threshold Touchthreshold until the baseline of the pad is calibrated.
  * @param stateChangeCB Callback to notify about pressed or released touch button.
  */
 CTouch::CTouch (uint8_t pin, uint8_t threshold, void (*stateChangeCB)(uint8_t, bool)){
   _state = false;
   _pin = pin;
+  _pad = (touch_pad_t)digitalPinToTouchChannel(pin);
   _threshold = threshold;
   _lastTick = millis();
   _stateChangeCB = stateChangeCB; 
@@ -29,6 +79,77 @@ CTouch::~CTouch(){
 
 }
 
+/**
+ * @brief Configure pad with threshold relative to the calibrated baseline. Requires touchBegin().
+ *  The baseline is tracked by debounce() as soon as the filter provides values.
+ * 
+ */
+void CTouch::begin(){
+  if (touchBaseline[_pad] != 0){
+    _threshold = (uint32_t)touchBaseline[_pad]*TOUCH_THRESHOLD/100;
+  }
+  touch_pad_config(_pad, _threshold);
+  _nextCalibration = millis() + TOUCH_CALIBRATE_DELAY*TOUCH_FILTER_PERIOD;
+}
+
+/**
+ * @brief Track baseline with the value of the released pad and adjust the threshold.
+ * 
+ * @param value Filtered pad value.
+ */
+void CTouch::calibrate(uint16_t value){
+  if (value == 0 || value < _threshold){
+    return;
+  }
+  if (touchBaseline[_pad] == 0){
+    touchBaseline[_pad] = value;
+  } else {
+    touchBaseline[_pad] += ((int32_t)value - touchBaseline[_pad])/TOUCH_BASELINE_WEIGHT;
+  }
+  _threshold = (uint32_t)touchBaseline[_pad]*TOUCH_THRESHOLD/100;
+  touch_pad_set_thresh(_pad, _threshold);
+}
+
+/**
+ * @brief Confirm a touch wakeup by sampling the pad for a short window. Requires begin().
+ * 
+ * @return true Pad is touched for at least half of the samples.
+ * @return false False wakeup.
+ */
+bool CTouch::confirmWake(){
+  uint8_t touched = 0;
+  for (uint8_t i=0; i<TOUCH_CONFIRM_SAMPLES; i++){
+    uint16_t value;
+    if (touch_pad_read(_pad, &value) == ESP_OK && value < _threshold){
+      touched++;
+    }
+    delay(TOUCH_CONFIRM_INTERVAL);
+  }
+  bool confirmed = touched*2 >= TOUCH_CONFIRM_SAMPLES;
+  touchWakes++;
+  if (!confirmed){
+    rejectedWakes++;
+  }
+  Serial.print("Touch wakeups rejected: ");
+  Serial.print(rejectedWakes);
+  Serial.print(" of ");
+  Serial.println(touchWakes);
+  return confirmed;
+}
+
+/**
+ * @brief Read filtered pad value.
+ * 
+ * @return uint16_t Pad value, lower if touched. 0 if the value is not available.
+ */
+uint16_t CTouch::read(){
+  uint16_t value;
+  if (touch_pad_read_filtered(_pad, &value) != ESP_OK){
+    return 0;
+  }
+  return value;
+}
+
 /**
  * @brief Set the state of the touch button and notify registered callback if state is changed.
  * 
@@ -53,17 +174,33 @@ void CTouch::inject(){
 }
 
 /**
- * @brief Debounce the touch input and generate a notification call if state has changed. Shall be called frequently to avoid delays.
+ * @brief Check if touch button is pressed. Pressed buttons have to be debounced frequently until released.
+ * 
+ * @return true Touch button pressed.
+ */
+bool CTouch::pressed(){
+  return _state;
+}
+
+/**
+ * @brief Debounce the touch input and generate a notification call if state has changed. Shall be called after 
+ *  touch interrupts and frequently while the button is pressed.
  * 
  */
 void CTouch::debounce (){
-  bool currentState = touchRead(_pin) < _threshold;
+  uint16_t value = read();
+  bool currentState = value != 0 && value < _threshold;
   if (currentState == true){
     setState(true);
   } else {
     if ((millis()-_lastTick) > 30){
       setState (false);
     }
+    // baseline drift is tracked while released, rate limited
+    if (!_state && value != 0 && (int32_t)(millis() - _nextCalibration) >= 0){
+      calibrate(value);
+      _nextCalibration = millis() + TOUCH_CALIBRATE_INTERVAL;
+    }
   }
 }
 
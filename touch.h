@@ -4,6 +4,9 @@
  * @date 9 Feb 2018
  * @brief Driver for touch buttons.
  *
+ * - Touch interrupt and filter mode of the touch peripheral
+ * - Baseline calibration
+ * - Rejection of false touch wakeups
  * - Debouncing 
  * - Event notification
  */
@@ -12,12 +15,19 @@
 #define _BUTTON_H_
 
 #include "Arduino.h"
+#include <driver/touch_pad.h>
+
+void touchBegin();
+void touchWait(TickType_t ticks);
 
 class CTouch
 {
 public:
   CTouch (uint8_t pin, uint8_t threshold, void (*stateChangeCB)(uint8_t, bool));
+  void begin();
+  bool confirmWake();
   void debounce();  
+  bool pressed();
   void setStateChangeCB (void (*function)(uint8_t pin, bool state));
   void inject();
   ~CTouch();
@@ -26,9 +36,13 @@ protected:
 
 private:
   void setState(boolean state);
+  void calibrate(uint16_t value);
+  uint16_t read();
   uint8_t _pin;
-  uint8_t _threshold;
+  touch_pad_t _pad;
+  uint16_t _threshold;
   uint32_t _lastTick;
+  uint32_t _nextCalibration;
   bool _state;
   void (*_stateChangeCB)(uint8_t, bool) = NULL;
 };
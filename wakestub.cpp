@@ -0,0 +1,101 @@
+/**
+ * @file wakestub.cpp
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Deep sleep wake stub which skips minute wakeups without full boot.
+ *
+ * The wake stub runs from RTC fast memory before the bootloader. After a timer wakeup 
+ * it checks the wake plan stored in RTC slow memory by the application. As long as 
+ * wakeups are left to be skipped, the RTC timer is rearmed for the next minute and 
+ * the chip goes back to deep sleep without loading the application.
+ * 
+ * Only ROM functions and code and data in RTC memory may be used by the wake stub.
+ */
+
+#include <Arduino.h>
+#include <esp_attr.h>
+#include <esp_clk.h>
+#include <esp_deep_sleep.h>
+#include <rom/rtc.h>
+#include <soc/rtc_cntl_reg.h>
+#include <soc/soc.h>
+#include "wakestub.h"
+
+#define WAKE_PLAN_MAGIC 0x57414B45
+#define RTC_TIMER_TRIG_EN 0x08
+
+struct WakePlan {
+  uint32_t magic;
+  uint32_t minuteTicks;   // RTC slow clock ticks of one minute
+  uint32_t skipWakes;     // timer wakeups to be handled by the wake stub
+  uint32_t checksum;
+};
+
+RTC_DATA_ATTR struct WakePlan wakePlan;
+RTC_DATA_ATTR uint8_t skippedWakes = 0;
+
+/**
+ * @brief Checksum over all fields of the wake plan.
+ * 
+ * @return uint32_t 
+ */
+static RTC_IRAM_ATTR uint32_t wakePlanChecksum(){
+  return ~(wakePlan.magic ^ wakePlan.minuteTicks ^ wakePlan.skipWakes);
+}
+
+/**
+ * @brief Wake stub executed before the bootloader. Decides if a full boot is needed.
+ *  RTC fast memory is not modified, so the CRC checked by the ROM before entering the stub stays valid.
+ * 
+ */
+extern "C" void RTC_IRAM_ATTR esp_wake_deep_sleep(void) {
+  esp_default_wake_deep_sleep();
+  uint32_t cause = REG_GET_FIELD(RTC_CNTL_WAKEUP_STATE_REG, RTC_CNTL_WAKEUP_CAUSE);
+  if ((cause & RTC_TIMER_TRIG_EN) == 0 || wakePlan.magic != WAKE_PLAN_MAGIC || 
+      wakePlan.checksum != wakePlanChecksum() || wakePlan.skipWakes == 0){
+    return; // touch wakeup, invalid plan or clock update needed: full boot
+  }
+  wakePlan.skipWakes--;
+  wakePlan.checksum = wakePlanChecksum();
+  skippedWakes++;
+
+  // next alarm one minute after the alarm which caused this wakeup to avoid drift
+  uint64_t alarm = REG_READ(RTC_CNTL_SLP_TIMER0_REG) | 
+    ((uint64_t)(REG_READ(RTC_CNTL_SLP_TIMER1_REG) & 0xffff) << 32);
+  alarm += wakePlan.minuteTicks;
+  REG_WRITE(RTC_CNTL_SLP_TIMER0_REG, alarm & UINT32_MAX);
+  REG_WRITE(RTC_CNTL_SLP_TIMER1_REG, alarm >> 32);
+
+  // back to deep sleep, wakeup sources are unchanged
+  REG_WRITE(RTC_ENTRY_ADDR_REG, (uint32_t)&esp_wake_deep_sleep);
+  CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+  SET_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+  while (true) {;}
+}
+
+/**
+ * @brief Set number of following minute wakeups, which shall be handled by the wake stub without full boot.
+ *  Shall be called right before entering deep sleep.
+ * 
+ * @param skipWakes Number of minute wakeups without full boot.
+ */
+void wakeStubPlan(uint8_t skipWakes){
+  // slow clock period is given in microseconds as Q13.19 fixed point value
+  uint64_t minuteTicks = (60000000ULL << 19) / esp_clk_slowclk_cal_get();
+  wakePlan.magic = WAKE_PLAN_MAGIC;
+  wakePlan.minuteTicks = (uint32_t)minuteTicks;
+  wakePlan.skipWakes = skipWakes;
+  wakePlan.checksum = wakePlanChecksum();
+}
+
+/**
+ * @brief Get number of minute wakeups handled by the wake stub since last boot. Invalidates the wake plan.
+ * 
+ * @return uint8_t Number of skipped wakeups.
+ */
+uint8_t wakeStubTakeSkipped(){
+  uint8_t skipped = skippedWakes;
+  skippedWakes = 0;
+  wakePlan.magic = 0;
+  return skipped;
+}
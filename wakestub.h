@@ -0,0 +1,17 @@
+/**
+ * @file wakestub.h
+ * @author Christof Menzenbach
+ * @date 9 Feb 2018
+ * @brief Deep sleep wake stub which skips minute wakeups without full boot.
+ *
+ */
+
+#ifndef _WAKESTUB_H_
+#define _WAKESTUB_H_
+
+#include <Arduino.h>
+
+void wakeStubPlan(uint8_t skipWakes);
+uint8_t wakeStubTakeSkipped();
+
+#endif